@@ -3,10 +3,49 @@
 
 //#define DEBUG
 //#define DIFF_TEST
+//#define ITRACE
+//#define OPCODE_STAT
+//#define CACHE_SIM
+//#define BRANCH_SIM
 
 /* You will define this macro in PA2 */
 #define HAS_IOE
 
+/* Reuse decoded instructions indexed by eip. It is turned off in DEBUG
+ * mode, since a cached instruction does not produce its assembly text.
+ */
+#ifndef DEBUG
+#define DECODE_CACHE
+#endif
+
+/* Execute cached basic blocks instead of one instruction at a time.
+ * Comment it out to go back to the per-instruction interpreter.
+ */
+#ifdef DECODE_CACHE
+#define BLOCK_ENGINE
+#endif
+
+/* Keep the last instructions executed in a ring buffer, see
+ * monitor/itrace.h. It is always on in DEBUG mode.
+ */
+#if defined(DEBUG) && !defined(ITRACE)
+#define ITRACE
+#endif
+
+/* Translate hot blocks to host machine code. Only x86-64 hosts are
+ * supported. Translated blocks are not traced, counted by OPCODE_STAT or
+ * fetched through the caches of CACHE_SIM.
+ */
+#if defined(BLOCK_ENGINE) && defined(__x86_64__) && !defined(ITRACE) && \
+  !defined(OPCODE_STAT) && !defined(CACHE_SIM)
+#define JIT
+#endif
+
+/* State private to a guest CPU. Each guest CPU runs in its own host
+ * thread, see cpu/mp.h.
+ */
+#define CPU_LOCAL __thread
+
 #include "debug.h"
 #include "macro.h"
 
@@ -0,0 +1,25 @@
+#ifndef __BLOCK_H__
+#define __BLOCK_H__
+
+#include "cpu/decode-cache.h"
+
+#define NR_BLOCK 4096               // must be a power of 2
+#define MAX_BLOCK_LEN 64
+#define BLOCK_POOL_SIZE (256 * 1024)
+
+uint32_t exec_block(uint64_t);
+void block_stat(void);
+
+/* Host code of an instruction, together with its share of the block
+ * prologue and epilogue, is shorter than this. The code cache holds a
+ * full block pool, and it is flushed together with the pool.
+ */
+#define JIT_INSTR_SIZE 128
+#define JIT_CACHE_SIZE (BLOCK_POOL_SIZE * JIT_INSTR_SIZE)
+
+void* jit_translate(const DecodeCacheEntry *, int);
+uint32_t jit_exec(void *, uint32_t, uint32_t, uint32_t);
+void jit_flush(void);
+void jit_stat(void);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef __BRANCH_PRED_H__
+#define __BRANCH_PRED_H__
+
+#include "common.h"
+
+#ifdef BRANCH_SIM
+
+/* The branch predictor models follow the branches of CPU 0. The direction
+ * of jcc is predicted by a bimodal and a gshare predictor side by side,
+ * both with 2-bit counters. The target of a taken branch is looked up in
+ * a direct-mapped BTB, and the target of ret is popped from a return
+ * address stack.
+ *
+ * Like the counters of real hardware, a misprediction is a wrong
+ * direction of jcc (by gshare), a wrong target of an indirect jmp or
+ * call from the BTB, or a wrong target of ret from the stack. A direct
+ * branch missing in the BTB is only counted as a BTB miss.
+ */
+
+#define BP_BIMODAL_BITS 12
+#define BP_GSHARE_BITS 14   // also the length of the global history
+#define BP_BTB_BITS 10
+#define BP_RAS_DEPTH 16
+
+enum { BP_JCC, BP_JMP, BP_CALL, BP_JMP_RM, BP_CALL_RM, BP_RET, NR_BP_KIND };
+
+/* Called by a branch at `eip' whose next instruction is at `next'. */
+void bpred_branch(int kind, vaddr_t eip, vaddr_t next, vaddr_t target, bool taken);
+
+void init_bpred(void);
+void bpred_report(int top);
+
+#endif
+
+#endif
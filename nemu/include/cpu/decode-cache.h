@@ -0,0 +1,117 @@
+#ifndef __DECODE_CACHE_H__
+#define __DECODE_CACHE_H__
+
+#include "cpu/exec.h"
+#include "cpu/opstat.h"
+
+typedef struct {
+  uint8_t type;
+  uint8_t width;
+  uint8_t load;
+  uint8_t load_width;
+  int8_t base_reg, index_reg;
+  uint8_t scale;
+  uint32_t val;   // register index, displacement or immediate
+} OperandRecipe;
+
+/* a decoded instruction */
+typedef struct DecodeCacheEntry {
+  vaddr_t eip;
+  uint32_t epoch;
+  uint32_t ppn;
+  uint32_t gen;
+  EHelper execute;
+  uint32_t opcode;
+  vaddr_t jmp_eip;
+  uint8_t len;
+  bool is_operand_size_16;
+  OperandRecipe src, dest, src2;
+} DecodeCacheEntry;
+
+extern CPU_LOCAL uint32_t dcache_epoch;
+extern uint32_t dcache_page_gen[NR_PMEM_PAGE];
+/* non-zero if some cached instruction is fetched from this physical page */
+extern uint8_t dcache_code_page[NR_PMEM_PAGE];
+
+/* the entry of the last instruction run by exec_wrapper(), NULL if it is not cached */
+extern CPU_LOCAL DecodeCacheEntry *dcache_last;
+
+void decode_cache_flush(void);
+void decode_cache_invalidate_page(uint32_t);
+
+bool decode_cache_exec(vaddr_t *);
+void decode_cache_begin(vaddr_t);
+void decode_cache_record(EHelper);
+void decode_cache_end(vaddr_t);
+void decode_cache_skip(void);
+
+void decode_cache_stat(void);
+
+/* called before the guest writes physical memory */
+static inline void decode_cache_check_write(paddr_t addr) {
+#ifdef DECODE_CACHE
+  uint32_t ppn = addr >> 12;
+  if (ppn < NR_PMEM_PAGE && dcache_code_page[ppn]) {
+    decode_cache_invalidate_page(ppn);
+  }
+#endif
+}
+
+static inline bool decode_cache_is_valid(uint32_t epoch, uint32_t ppn, uint32_t gen) {
+  return epoch == dcache_epoch && gen == dcache_page_gen[ppn];
+}
+
+static inline void replay_operand(Operand *op, const OperandRecipe *r) {
+  op->type = r->type;
+  op->width = r->width;
+  switch (r->type) {
+    case OP_TYPE_REG:
+      op->reg = r->val;
+      if (r->load == OP_LOAD_REG) {
+        rtl_lr(&op->val, op->reg, r->load_width);
+      }
+      else if (r->load == OP_LOAD_CR) {
+        rtl_load_cr(&op->val, op->reg);
+      }
+      break;
+    case OP_TYPE_MEM:
+      rtl_li(&op->addr, r->val);
+      if (r->base_reg != -1) {
+        rtl_add(&op->addr, &op->addr, &reg_l(r->base_reg));
+      }
+      if (r->index_reg != -1) {
+        rtl_shli(&t0, &reg_l(r->index_reg), r->scale);
+        rtl_add(&op->addr, &op->addr, &t0);
+      }
+      if (r->load == OP_LOAD_MEM) {
+        rtl_lm(&op->val, &op->addr, r->load_width);
+      }
+      break;
+    default:
+      op->imm = r->val;
+      rtl_li(&op->val, r->val);
+      break;
+  }
+}
+
+/* Execute a decoded instruction. `*eip' should point to the instruction. */
+static inline void decode_cache_replay(const DecodeCacheEntry *e, vaddr_t *eip) {
+  decoding.opcode = e->opcode;
+  decoding.is_operand_size_16 = e->is_operand_size_16;
+  decoding.jmp_eip = e->jmp_eip;
+#ifdef OPCODE_STAT
+  uint64_t t = opstat_decode_begin();
+#endif
+  replay_operand(id_src2, &e->src2);
+  replay_operand(id_dest, &e->dest);
+  replay_operand(id_src, &e->src);
+#ifdef OPCODE_STAT
+  opstat_decode_end(t);
+#endif
+
+  *eip += e->len;
+  e->execute(eip);
+  decoding.is_operand_size_16 = false;
+}
+
+#endif
@@ -7,6 +7,9 @@
 
 enum { OP_TYPE_REG, OP_TYPE_MEM, OP_TYPE_IMM };
 
+/* how the value of an operand is loaded, recorded for the decode cache */
+enum { OP_LOAD_NONE, OP_LOAD_REG, OP_LOAD_MEM, OP_LOAD_CR };
+
 #define OP_STR_SIZE 40
 
 typedef struct {
@@ -19,6 +22,14 @@ typedef struct {
     int32_t simm;
   };
   rtlreg_t val;
+
+  /* recipe to rebuild the operand without decoding it again */
+  uint8_t load;
+  uint8_t load_width;
+  int8_t base_reg, index_reg;
+  uint8_t scale;
+  int32_t disp;
+
   char str[OP_STR_SIZE];
 } Operand;
 
@@ -64,8 +75,15 @@ void read_ModR_M(vaddr_t *, Operand *, bool, Operand *, bool);
 
 void operand_write(Operand *, rtlreg_t *);
 
+/* operand_write() with the width known at compile time */
+static inline void operand_write_w(Operand *op, rtlreg_t* src, const int width) {
+  if (op->type == OP_TYPE_REG) { rtl_sr(op->reg, width, src); }
+  else if (op->type == OP_TYPE_MEM) { rtl_sm(&op->addr, width, src); }
+  else { assert(0); }
+}
+
 /* shared by all helper functions */
-extern DecodeInfo decoding;
+extern CPU_LOCAL DecodeInfo decoding;
 
 #define id_src (&decoding.src)
 #define id_src2 (&decoding.src2)
@@ -83,6 +101,7 @@ make_DHelper(I_E2G);
 make_DHelper(I_G2E);
 make_DHelper(I);
 make_DHelper(r);
+make_DHelper(a2r);
 make_DHelper(E);
 make_DHelper(gp7_E);
 make_DHelper(test_I);
@@ -6,16 +6,41 @@
 #define make_EHelper(name) void concat(exec_, name) (vaddr_t *eip)
 typedef void (*EHelper) (vaddr_t *);
 
+/* An execution helper defined with make_EHelper_W() also gets the copies
+ * exec_<name>_b, exec_<name>_w and exec_<name>_l, in which `width' (the
+ * width of the destination operand) is a compile-time constant. The
+ * decode cache replays the copy matching the decoded width.
+ */
+#define make_EHelper_W(name) \
+  static inline __attribute__((always_inline)) void concat(exec_body_, name) (vaddr_t *eip, const int width); \
+  make_EHelper(name) { concat(exec_body_, name)(eip, id_dest->width); } \
+  make_EHelper(concat(name, _b)) { concat(exec_body_, name)(eip, 1); } \
+  make_EHelper(concat(name, _w)) { concat(exec_body_, name)(eip, 2); } \
+  make_EHelper(concat(name, _l)) { concat(exec_body_, name)(eip, 4); } \
+  static inline __attribute__((always_inline)) void concat(exec_body_, name) (vaddr_t *eip, const int width)
+
+#define decl_EHelper_W(name) \
+  make_EHelper(name); \
+  make_EHelper(concat(name, _b)); \
+  make_EHelper(concat(name, _w)); \
+  make_EHelper(concat(name, _l))
+
 #include "cpu/decode.h"
+#include "monitor/itrace.h"
 
 static inline uint32_t instr_fetch(vaddr_t *eip, int len) {
-  uint32_t instr = vaddr_read(*eip, len);
+  uint32_t instr = vaddr_ifetch(*eip, len);
 #ifdef DEBUG
-  uint8_t *p_instr = (void *)&instr;
-  int i;
-  for (i = 0; i < len; i ++) {
-    decoding.p += sprintf(decoding.p, "%02x ", p_instr[i]);
+  if (decoding.p != NULL) {
+    uint8_t *p_instr = (void *)&instr;
+    int i;
+    for (i = 0; i < len; i ++) {
+      decoding.p += sprintf(decoding.p, "%02x ", p_instr[i]);
+    }
   }
+#endif
+#ifdef ITRACE
+  itrace_fetch(instr, len);
 #endif
   (*eip) += len;
   return instr;
@@ -34,7 +59,12 @@ static inline const char* get_cc_name(int subcode) {
 }
 
 #ifdef DEBUG
-#define print_asm(...) Assert(snprintf(decoding.assembly, 80, __VA_ARGS__) < 80, "buffer overflow!")
+/* the assembly text is only built to be printed, see exec_wrapper() */
+#define print_asm(...) \
+  do { \
+    if (decoding.p != NULL) \
+      Assert(snprintf(decoding.assembly, 80, __VA_ARGS__) < 80, "buffer overflow!"); \
+  } while (0)
 #else
 #define print_asm(...)
 #endif
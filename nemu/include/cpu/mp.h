@@ -0,0 +1,35 @@
+#ifndef __MP_H__
+#define __MP_H__
+
+#include "common.h"
+
+/* NEMU can run several guest CPUs, each in its own host thread. CPU 0
+ * runs in the main thread together with the monitor and the device
+ * events, and the others only run while CPU 0 is running in cpu_exec().
+ * Registers, decoding state and all caches are private to a CPU (see
+ * CPU_LOCAL), while pmem and devices are shared.
+ */
+
+#define MAX_CPU 8
+
+extern int nr_cpu;
+extern CPU_LOCAL int cpu_id;
+
+void init_mp(int);
+void mp_resume(void);
+void mp_pause(void);
+
+void mp_start(vaddr_t);
+void mp_halt(void);
+
+/* Serialize locked read-modify-writes: the instructions with the lock
+ * prefix, and xchg and cmpxchg with a memory operand. A CPU may take the
+ * bus lock again while it holds it. */
+void mp_lock_bus(void);
+void mp_unlock_bus(void);
+
+/* serialize device accesses */
+void mp_lock_io(void);
+void mp_unlock_io(void);
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef __OPSTAT_H__
+#define __OPSTAT_H__
+
+#include "common.h"
+
+#ifdef OPCODE_STAT
+
+/* Opcode statistics count the instructions executed by opcode, and by
+ * the addressing form of their memory operand. One in OPSTAT_TIME_EVERY
+ * instructions on average is timed, at random so that loops do not
+ * always time the same instructions, and its host cycles are split into
+ * decoding, including loading the operands, and execution. The cycles
+ * include the cost of reading the timer.
+ */
+
+#define OPSTAT_TIME_EVERY 32
+
+extern CPU_LOCAL bool opstat_timed;
+extern CPU_LOCAL uint64_t opstat_decode_cycles;
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+static inline uint64_t opstat_now(void) { return __rdtsc(); }
+#else
+#include <time.h>
+/* in nanoseconds */
+static inline uint64_t opstat_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+#endif
+
+static inline uint64_t opstat_decode_begin(void) {
+  return (opstat_timed ? opstat_now() : 0);
+}
+
+static inline void opstat_decode_end(uint64_t t) {
+  if (opstat_timed) opstat_decode_cycles += opstat_now() - t;
+}
+
+struct DecodeCacheEntry;
+
+/* called around each instruction, with its decode cache entry if it is
+ * replayed, or NULL if it is decoded */
+void opstat_begin(void);
+void opstat_end(const struct DecodeCacheEntry *);
+
+void init_opstat(void);
+void opstat_report(int top);
+
+#endif
+
+#endif
@@ -63,12 +63,20 @@ typedef struct {
 
   //INTR硬件中断
   bool INTR;
+
+  //the last operation setting CF, ZF, SF and OF, see rtl_set_cc()
+  struct {
+    uint32_t op, width;
+    rtlreg_t dest, src, res;
+  } cc;
 } CPU_state;
 
-extern CPU_state cpu;
+extern CPU_LOCAL CPU_state cpu;
 
 static inline int check_reg_index(int index) {
+#ifdef DEBUG
   assert(index >= 0 && index < 8);
+#endif
   return index;
 }
 
@@ -3,7 +3,7 @@
 
 #include "nemu.h"
 
-extern rtlreg_t t0, t1, t2, t3;
+extern CPU_LOCAL rtlreg_t t0, t1, t2, t3;
 extern const rtlreg_t tzero;
 
 /* RTL basic instructions */
@@ -111,13 +111,42 @@ static inline void rtl_sr(int r, int width, const rtlreg_t* src1) {
   }
 }
 
+/* CF, ZF, SF and OF are computed lazily. An ALU helper only records its
+ * operation, operands and result in cpu.cc with rtl_set_cc(), and
+ * eflags are brought up to date when they are read or partially written.
+ */
+enum { CC_OP_NONE, CC_OP_ADD, CC_OP_SUB, CC_OP_LOGIC, CC_OP_INC, CC_OP_DEC, CC_OP_ZFSF };
+
+void rtl_cc_materialize(void);
+
+static inline void rtl_cc_sync() {
+  if (cpu.cc.op != CC_OP_NONE) {
+    rtl_cc_materialize();
+  }
+}
+
+static inline void rtl_set_cc(int op, const rtlreg_t* dest, const rtlreg_t* src,
+    const rtlreg_t* res, int width) {
+  // INC, DEC and ZFSF keep some flags of the previous operation
+  if (op >= CC_OP_INC) {
+    rtl_cc_sync();
+  }
+  cpu.cc.op = op;
+  cpu.cc.width = width;
+  cpu.cc.dest = *dest;
+  cpu.cc.src = *src;
+  cpu.cc.res = *res;
+}
+
 #define make_rtl_setget_eflags(f) \
   static inline void concat(rtl_set_, f) (const rtlreg_t* src) { \
     /* TODO();*/ \
+    rtl_cc_sync();\
     cpu.eflags.f=*src;\
   } \
   static inline void concat(rtl_get_, f) (rtlreg_t* dest) { \
     /* TODO();*/ \
+    rtl_cc_sync();\
     *dest=cpu.eflags.f;\
   }
 
@@ -229,16 +258,22 @@ static inline void rtl_load_cr(rtlreg_t* dest,int r){
   }
 }
 
+void decode_cache_flush(void);
+
 static inline void rtl_store_cr(int r,rtlreg_t* src){
   assert(r==0||r==3);
   switch(r){
     case 0:
       cpu.CR0=*src;
-      return;
+      break;
     case 3:
       cpu.CR3=*src;
-      return;
+      break;
   }
+  /* the address space may change */
+  tlb_flush();
+  /* eip may be mapped to different instructions now */
+  decode_cache_flush();
 }
 
 #endif
@@ -0,0 +1,39 @@
+#ifndef __EVENT_H__
+#define __EVENT_H__
+
+#include "common.h"
+
+/* Devices schedule their work in an event queue, whose clock is the
+ * number of guest instructions executed. cpu_exec() never runs past the
+ * next event, and calls event_advance() after each batch of instructions.
+ */
+
+/* the guest is assumed to run this many instructions per second */
+#define INSTR_PER_SEC (50 * 1000 * 1000)
+/* the frequency of the timer interrupt of each CPU */
+#define TIMER_HZ 100
+
+typedef void (*event_handler_t)(void);
+
+extern uint64_t nr_guest_instr;
+extern uint64_t next_event;
+
+int add_event(const char *, event_handler_t);
+void event_schedule(int, uint64_t);
+void event_run(void);
+void update_next_event(void);
+
+/* the number of instructions which can run before the next event, at most n */
+static inline uint64_t event_budget(uint64_t n) {
+  uint64_t left = next_event - nr_guest_instr;
+  return (left < n ? left : n);
+}
+
+static inline void event_advance(uint64_t n) {
+  nr_guest_instr += n;
+  if (nr_guest_instr >= next_event) {
+    event_run();
+  }
+}
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef __REPLAY_H__
+#define __REPLAY_H__
+
+#include "common.h"
+
+/* Nondeterministic inputs of devices can be recorded to a file, and fed
+ * back in a later run, so that the guest executes exactly the same
+ * instructions. Timer interrupts need no recording, since they are
+ * driven by the instruction count (see device/event.h).
+ */
+
+enum { REPLAY_OFF, REPLAY_RECORD, REPLAY_PLAY };
+enum { INPUT_KEY, INPUT_RTC };
+
+extern int replay_mode;
+
+void init_replay(const char *, int);
+uint32_t replay_input(int, uint32_t);
+bool replay_pending(int, uint32_t *);
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include "common.h"
+
+#ifdef CACHE_SIM
+
+/* The cache simulator models the caches of CPU 0: L1I and L1D, backed by
+ * a unified L2, all write-back and write-allocate. They are indexed and
+ * tagged by physical address, and only hold pmem. Each cache is
+ * configured with -k, e.g.
+ *   -k l1i=32K:8:64:lru,l1d=32K:8:64:lru,l2=256K:8:64:random
+ * as size:associativity:line size:replacement policy, where the policy is
+ * lru, fifo or random. A cache of size 0 is left out.
+ *
+ * Every instruction executed is fetched through L1I, once, even if it is
+ * replayed from the decode cache. The hit and miss statistics are also
+ * counted by the guest function executing, with the symbols of -E.
+ */
+
+enum { CACHE_L1I, CACHE_L1D, CACHE_L2, NR_CACHE };
+
+bool init_cache(const char *config);
+void cache_report(int top);
+
+/* called before each instruction, and after it with its length */
+void cache_instr_begin(vaddr_t eip);
+void cache_ifetch(paddr_t addr, int len);
+/* called for each access of pmem, type is MEM_READ or MEM_WRITE */
+void cache_data(paddr_t addr, int len, int type);
+
+#endif
+
+#endif
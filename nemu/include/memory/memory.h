@@ -2,17 +2,121 @@
 #define __MEMORY_H__
 
 #include "common.h"
+#include "memory/cache.h"
 
-extern uint8_t pmem[];
+/* the default size of pmem, which can be changed up to PMEM_MAX_SIZE */
+#define PMEM_SIZE (128 * 1024 * 1024)
+#define PMEM_MAX_SIZE (1u << 31)
+#define NR_PMEM_PAGE (PMEM_MAX_SIZE >> 12)
+
+/* All guest CPUs share pmem, but the reference of differential testing
+ * runs on a copy of its own, see diff-test/ref.c.
+ */
+extern CPU_LOCAL uint8_t *pmem;
+extern uint32_t pmem_size;
+
+void init_pmem(uint32_t, bool);
+void pmem_reset(void);
+bool pmem_map_file(paddr_t, int, uint32_t);
+
+/* non-zero if the page is written by the guest since the last snapshot */
+extern uint8_t pmem_dirty[NR_PMEM_PAGE];
+void pmem_clear_dirty(void);
+
+/* a hash of the pages written by this thread since the last call,
+ * tracked in DIFF_TEST mode only */
+uint64_t pmem_written_hash(void);
 
 /* convert the guest physical address in the guest program to host virtual address in NEMU */
 #define guest_to_host(p) ((void *)(pmem + (unsigned)p))
 /* convert the host virtual address in NEMU to guest physical address in the guest program */
 #define host_to_guest(p) ((paddr_t)((void *)p - (void *)pmem))
 
-uint32_t vaddr_read(vaddr_t, int);
+/* type of memory accesses */
+enum { MEM_READ, MEM_WRITE, MEM_FETCH };
+
+paddr_t page_translate(vaddr_t, int);
+void tlb_flush(void);
+void tlb_flush_page(vaddr_t);
+
+uint32_t vaddr_read_slow(vaddr_t, int);
+uint32_t vaddr_ifetch(vaddr_t, int);
 uint32_t paddr_read(paddr_t, int);
-void vaddr_write(vaddr_t, int, uint32_t);
+void vaddr_write_slow(vaddr_t, int, uint32_t);
 void paddr_write(paddr_t, int, uint32_t);
+uint32_t vaddr_xchg(vaddr_t, int, uint32_t);
+uint32_t vaddr_cmpxchg(vaddr_t, int, uint32_t, uint32_t);
+bool vaddr_peek(vaddr_t, int, uint32_t *);
+
+/* Host addresses of recently accessed virtual pages which are backed by
+ * pmem, one table for reads and one for writes. An access inside such a
+ * page does not go through address translation and MMIO dispatch. Pages
+ * holding cached instructions never enter `host_tlb_w', so writes to
+ * them still take the slow path and invalidate the decode cache. A page
+ * enters `host_tlb_w' only after a slow write has marked it dirty.
+ */
+#define NR_HOST_TLB 1024   // must be a power of 2
+
+typedef struct {
+  vaddr_t tag;     // virtual page address | 1, or 0 if invalid
+  uint8_t *host;
+} HostTLBEntry;
+
+extern CPU_LOCAL HostTLBEntry host_tlb_r[NR_HOST_TLB], host_tlb_w[NR_HOST_TLB];
+
+void host_tlb_flush_write(void);
+void host_tlb_flush_all(void);
+
+/* With several CPUs, a code page marked by one CPU may still be in
+ * `host_tlb_w' of the others. Each CPU catches up between blocks.
+ * `host_tlb_r' is only flushed this way for a new memory watchpoint.
+ */
+extern uint32_t host_tlb_w_epoch;
+extern CPU_LOCAL uint32_t host_tlb_w_local_epoch;
+void host_tlb_sync_slow(void);
+
+static inline void host_tlb_sync(void) {
+  if (host_tlb_w_local_epoch != host_tlb_w_epoch) {
+    host_tlb_sync_slow();
+  }
+}
+
+static inline uint8_t* host_tlb_lookup(HostTLBEntry *tlb, vaddr_t addr, int len) {
+  HostTLBEntry *e = &tlb[(addr >> 12) & (NR_HOST_TLB - 1)];
+  if (e->tag == ((addr & ~0xfff) | 1) && (addr & 0xfff) <= 0x1000 - len) {
+    return e->host + (addr & 0xfff);
+  }
+  return NULL;
+}
+
+static inline uint32_t vaddr_read(vaddr_t addr, int len) {
+  uint8_t *p = host_tlb_lookup(host_tlb_r, addr, len);
+  if (p != NULL) {
+#ifdef CACHE_SIM
+    cache_data(host_to_guest(p), len, MEM_READ);
+#endif
+    switch (len) {
+      case 4: return *(uint32_t *)p;
+      case 2: return *(uint16_t *)p;
+      case 1: return *p;
+    }
+  }
+  return vaddr_read_slow(addr, len);
+}
+
+static inline void vaddr_write(vaddr_t addr, int len, uint32_t data) {
+  uint8_t *p = host_tlb_lookup(host_tlb_w, addr, len);
+  if (p != NULL) {
+#ifdef CACHE_SIM
+    cache_data(host_to_guest(p), len, MEM_WRITE);
+#endif
+    switch (len) {
+      case 4: *(uint32_t *)p = data; return;
+      case 2: *(uint16_t *)p = data; return;
+      case 1: *p = data; return;
+    }
+  }
+  vaddr_write_slow(addr, len, data);
+}
 
 #endif
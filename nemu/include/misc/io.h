@@ -0,0 +1,33 @@
+#ifndef __IO_H__
+#define __IO_H__
+
+#include "common.h"
+#include <unistd.h>
+
+/* Read or write exactly `n' bytes of a file descriptor, e.g. a pipe which
+ * transfers less at a time. Return false on an error or at the end of
+ * the file. Both only call read() and write(), so they can be used in a
+ * signal handler.
+ */
+
+static inline bool read_all(int fd, void *buf, size_t n) {
+  while (n > 0) {
+    ssize_t ret = read(fd, buf, n);
+    if (ret <= 0) return false;
+    buf += ret;
+    n -= ret;
+  }
+  return true;
+}
+
+static inline bool write_all(int fd, const void *buf, size_t n) {
+  while (n > 0) {
+    ssize_t ret = write(fd, buf, n);
+    if (ret <= 0) return false;
+    buf += ret;
+    n -= ret;
+  }
+  return true;
+}
+
+#endif
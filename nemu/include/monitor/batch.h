@@ -0,0 +1,15 @@
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include "common.h"
+
+/* Run a list of images on a pool of worker processes. Each worker is
+ * forked from the initialized monitor, so it starts from a copy-on-write
+ * copy of the initial machine, and `load' puts an image into it.
+ * A summary line is printed for each image, and the exit code of NEMU
+ * tells whether all of them pass.
+ */
+
+void batch_run(char **, int, int, uint64_t, int, void (*)(const char *));
+
+#endif
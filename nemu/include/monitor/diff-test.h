@@ -0,0 +1,79 @@
+#ifndef __DIFF_TEST_H__
+#define __DIFF_TEST_H__
+
+#include "common.h"
+
+/* Differential testing runs the guest on a reference together with
+ * NEMU, and checks the state of NEMU against it after each step. A step
+ * is the instructions executed by one call of exec_block() or
+ * exec_wrapper() in cpu_exec().
+ *
+ * With checkpoints, the state is only checked every so many instructions,
+ * together with the memory written in between. See checkpoint.c.
+ */
+
+typedef struct {
+  uint32_t n;        // the number of instructions NEMU has executed
+  int intr;          // the interrupt NEMU has taken after them, or -1
+  bool skip_ref;     // the reference can not run the last instruction, copy NEMU instead
+  bool skip_dut;     // do not check NEMU for this step
+  bool check;        // check the registers after the step
+  bool check_mem;    // also check the memory written since the last check
+  uint64_t mem_hash; // pmem_written_hash() of NEMU if check_mem
+} DiffStep;
+
+typedef struct {
+  const char *name;
+  /* start the reference */
+  void (*init)(void);
+  /* copy guest memory to the reference */
+  void (*memcpy)(paddr_t, void *, size_t);
+  /* copy the registers of NEMU to the reference */
+  void (*setregs)(void);
+  /* run the step NEMU has just taken, and call difftest_fail() if they differ */
+  void (*step)(const DiffStep *);
+  /* NEMU has read a value from a device. NULL if the reference has no
+   * devices, then the instructions accessing devices are skipped. */
+  void (*device_read)(uint32_t);
+  /* return after all steps are checked, NULL if they are checked right away */
+  void (*sync)(void);
+  /* start over from the current state of NEMU in a forked process,
+   * NULL if the reference can not, then there are no checkpoints */
+  void (*restart)(void);
+  /* the reference can only check one instruction at a time */
+  bool single_step;
+} DiffTestBackend;
+
+void init_difftest(const char *, uint64_t);
+void difftest_start(void);
+bool difftest_rerun(uint64_t, uint64_t, uint64_t *, uint32_t *, vaddr_t *);
+void difftest_memcpy(paddr_t, void *, size_t);
+void difftest_setregs(void);
+void difftest_step(uint32_t);
+void difftest_sync(void);
+uint64_t difftest_budget(uint64_t);
+void difftest_fail(uint64_t, uint32_t, vaddr_t);
+
+/* called by NEMU while executing an instruction */
+void difftest_skip_ref(void);
+void difftest_skip_dut(void);
+void difftest_intr(uint8_t);
+void difftest_device_read(uint32_t);
+void difftest_device_write(void);
+bool difftest_replay_read(uint32_t *);
+bool difftest_replay_write(void);
+
+/* the in-process reference, see ref.c */
+extern CPU_LOCAL bool difftest_is_ref;
+uint32_t difftest_ref_device_read(void);
+void exec_ref(void);
+void exec_ref_intr(uint8_t);
+
+/* checkpoints, see checkpoint.c */
+void checkpoint_take(void);
+void checkpoint_bisect(uint64_t);
+void checkpoint_log_input(uint32_t);
+bool checkpoint_replay_read(uint32_t *);
+extern bool checkpoint_rerun;
+
+#endif
@@ -5,4 +5,21 @@
 
 uint32_t expr(char *, bool *);
 
+#define NR_EXPR_OP 32
+
+/* An expression compiled to postfix operations, so it can be evaluated
+ * many times without parsing it again, e.g. by a watchpoint. */
+typedef struct {
+  int nr_op;
+  struct {
+    int type;
+    uint32_t val;   // a number, or the index of a register
+  } op[NR_EXPR_OP];
+} CompiledExpr;
+
+bool expr_compile(char *, CompiledExpr *);
+/* Return false if it can not be evaluated, e.g. on a division by zero,
+ * or a dereference of MMIO or of a page not present. */
+bool expr_eval(const CompiledExpr *, uint32_t *);
+
 #endif
@@ -0,0 +1,54 @@
+#ifndef __FTRACE_H__
+#define __FTRACE_H__
+
+#include "common.h"
+
+/* The function trace follows the calls and returns of CPU 0: call and
+ * ret, and interrupts and iret. The events are logged to a file in binary
+ * records, and aggregated into a call graph with the number of calls and
+ * the guest instructions spent in each function, inclusive and exclusive
+ * of the functions it calls. Functions are symbolized with -E.
+ *
+ * A return is matched with the call which pushed its return address, so
+ * a longjmp closes the calls it skips. A return to another stack, e.g.
+ * after a context switch, matches no call and is only logged.
+ *
+ * A log is laid out as
+ *   FTRACE_MAGIC, the size of a record,
+ *   then the records in the order of the events.
+ */
+
+#define FTRACE_MAGIC "NEMUFTR1"
+/* deeper calls are not followed */
+#define FTRACE_MAX_DEPTH 4096
+
+enum { FTRACE_CALL, FTRACE_RET, FTRACE_INTR, FTRACE_IRET };
+
+typedef struct {
+  uint64_t instr;    // the number of guest instructions executed, including this one
+  uint32_t pc;       // call: the return address; return: where it returns to
+  uint32_t target;   // call: the function called; return: the function returned
+                     // from, or 0 if the return matches no call
+  uint8_t kind;
+  uint8_t pad[3];
+  uint32_t depth;    // of the calls followed, after the event
+} FTraceRecord;
+
+extern bool ftrace_on;
+
+void ftrace_event(int kind, vaddr_t pc, vaddr_t target, vaddr_t slot);
+
+/* Called by the instructions after they change the flow. `slot' is the
+ * address of the return address on the stack.
+ */
+static inline void ftrace_hook(int kind, vaddr_t pc, vaddr_t target, vaddr_t slot) {
+  if (ftrace_on) ftrace_event(kind, pc, target, slot);
+}
+
+/* called by cpu_exec() after each batch of instructions */
+void ftrace_commit(void);
+
+void init_ftrace(const char *);
+void ftrace_report(int top);
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef __ITRACE_H__
+#define __ITRACE_H__
+
+#include "common.h"
+
+/* The instruction trace keeps the last NR_ITRACE instructions executed
+ * by each CPU in a ring buffer of binary records. The ring is dumped to
+ * a file on a bad trap, a panic or a crash of NEMU, or by the `itrace'
+ * command. tools/itrace.py disassembles and filters the dumps.
+ *
+ * A dump is laid out as
+ *   ITRACE_MAGIC, the size of a record, the number of records,
+ *   then the records from the oldest to the newest.
+ */
+
+#define NR_ITRACE (1 << 16)   // must be a power of 2
+#define ITRACE_MAGIC "NEMUITR1"
+#define ITRACE_MAX_LEN 15
+
+typedef struct {
+  uint64_t seq;      // the number of instructions traced before it
+  uint32_t eip;
+  uint8_t len;
+  uint8_t changed;   // bit i is set if gpr[i] is changed by the instruction
+  uint8_t bytes[ITRACE_MAX_LEN];
+  uint8_t pad[3];
+  uint32_t gpr[8];   // after the instruction
+} ITraceRecord;
+
+void init_itrace(const char *);
+bool itrace_dump(const char *);
+
+/* called around each instruction */
+void itrace_begin(vaddr_t);
+void itrace_fetch(uint32_t, int);
+void itrace_end(int);
+
+#endif
@@ -1,7 +1,16 @@
 #ifndef __MONITOR_H__
 #define __MONITOR_H__
 
+#include "common.h"
+
 enum { NEMU_STOP, NEMU_RUNNING, NEMU_END };
 extern int nemu_state;
 
+/* how the program ended, set by the nemu_trap instruction */
+enum { TRAP_NONE, TRAP_GOOD, TRAP_BAD };
+extern int nemu_trap_state;
+
+/* true only in the thread of CPU 0 while it runs the guest in cpu_exec() */
+extern CPU_LOCAL bool cpu_exec_active;
+
 #endif
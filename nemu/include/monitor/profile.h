@@ -0,0 +1,17 @@
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+#include "common.h"
+
+/* The profiler samples the guest every so many instructions: eip, and
+ * the return addresses found by walking the frame pointers. Samples are
+ * symbolized with the symbols loaded by -E.
+ */
+
+#define PROFILE_MAX_DEPTH 16   // the return addresses kept, besides eip
+
+void init_profile(uint64_t interval, const char *folded_file);
+void profile_report(int top);
+bool profile_write_folded(const char *);
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include "common.h"
+
+/* A snapshot holds the whole machine: physical memory, the CPU state,
+ * and the sections of state registered by the devices with
+ * snapshot_add(). An incremental snapshot only holds the pages written
+ * since the last snapshot saved or loaded, and names that snapshot as
+ * its parent.
+ */
+
+void init_snapshot(void);
+void snapshot_add(void *, size_t, const char *, ...);
+
+bool snapshot_save(const char *, bool);
+bool snapshot_load(const char *);
+void snapshot_at(uint64_t, const char *);
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef __STAT_H__
+#define __STAT_H__
+
+#include "common.h"
+#include "monitor/monitor.h"
+
+/* Helpers shared by the tools which gather statistics of the guest: the
+ * profiler, the function trace, and the cache and branch simulators.
+ */
+
+/* A table of statistics in the order they are added, found by a key at
+ * the start of each entry. The key is compared as `key_size' bytes, a
+ * multiple of 4, so its padding must be cleared. The entries are indexed
+ * by a hash table with linear probing, which doubles as it fills up.
+ */
+typedef struct {
+  void *entries;
+  uint32_t entry_size, key_size;
+  uint32_t nr, max;
+  int *index;         // -1 if the slot is empty
+  uint32_t nr_slot;   // a power of 2
+} StatTable;
+
+void stat_table_init(StatTable *t, uint32_t entry_size, uint32_t key_size);
+/* The index of the entry with `key', which is added cleared if it is new.
+ * The entries may move, so pointers to them are invalidated. */
+int stat_get(StatTable *t, const void *key);
+
+static inline void* stat_entry(const StatTable *t, int i) {
+  return t->entries + (size_t)i * t->entry_size;
+}
+
+/* `a' in percent of `b', 0 if `b' is 0 */
+static inline double ratio(uint64_t a, uint64_t b) {
+  return (b == 0 ? 0.0 : 100.0 * a / b);
+}
+
+/* Is an event or a memory access from the guest executed by CPU 0? The
+ * monitor, e.g. `x', the other CPUs and the reference of differential
+ * testing are not traced.
+ */
+static inline bool stat_is_traced() {
+  return cpu_exec_active;
+}
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef __SYMBOL_H__
+#define __SYMBOL_H__
+
+#include "common.h"
+
+/* The function symbols of the guest programs, loaded from their ELF
+ * files given by -E, e.g. the kernel and the application it runs.
+ */
+
+bool symbol_load(const char *);
+/* the function containing `addr', and its start if `start' is not NULL,
+ * or NULL if there is none */
+const char* symbol_find(vaddr_t addr, vaddr_t *start);
+
+#define SYMBOL_BUF_LEN 16
+
+/* The same, but if there is no function, `addr' is printed in `buf' of
+ * SYMBOL_BUF_LEN bytes and taken as the start. */
+const char* symbol_name(vaddr_t addr, vaddr_t *start, char *buf);
+
+#endif
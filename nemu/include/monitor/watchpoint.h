@@ -2,6 +2,14 @@
 #define __WATCHPOINT_H__
 
 #include "common.h"
+#include "monitor/expr.h"
+
+/* An expression watchpoint is checked after each instruction in DEBUG
+ * mode. A memory watchpoint is checked by the slow path of the memory
+ * accesses, in any mode. The pages it watches are kept out of the host
+ * TLBs, so accesses to other pages do not pay for it.
+ */
+enum { WP_EXPR, WP_READ, WP_WRITE, WP_ACCESS };
 
 typedef struct watchpoint {
   int NO;
@@ -9,8 +17,14 @@ typedef struct watchpoint {
 
   /* TODO: Add more members if necessary */
   int oldValue;
-  char e[32];
+  char *e;
+  CompiledExpr ce;
   int hitNum;
+
+  /* memory watchpoints */
+  int type;
+  vaddr_t addr;
+  uint32_t len;
 } WP;
 
 bool new_wp(char *args);
@@ -18,4 +32,9 @@ bool free_wp(int num);
 void print_wp();
 bool watch_wp();
 
+bool new_mem_wp(int type, uint32_t len, char *args);
+extern int nr_mem_wp;
+bool mem_wp_page(vaddr_t);
+void mem_wp_check(vaddr_t, int, int, uint32_t);
+
 #endif
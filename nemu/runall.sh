@@ -19,21 +19,75 @@ fi
 
 files=`ls $AM_HOME/tests/cputest/build/*-x86-nemu.bin`
 ori_log="build/nemu-log.txt"
+logfile="build/runall-log.txt"
+resultfile="build/runall-result.txt"
+nr_fail=0
 
-for file in $files; do
-  base=`basename $file | sed -e 's/-x86-nemu.bin//'`
-  printf "[%14s] " $base
-  logfile=$base-log.txt
-  $nemu -b -l $ori_log $file &> $logfile
-
-  if (grep 'nemu: HIT GOOD TRAP' $logfile > /dev/null) then
-    echo -e "\033[1;32mPASS!\033[0m"
-    rm $logfile
-  else
-    echo -e "\033[1;31mFAIL!\033[0m see $logfile for more information"
-    if (test -e $ori_log) then
-      echo -e "\n\n===== the original log.txt =====\n" >> $logfile
-      cat $ori_log >> $logfile
+pass() {
+  echo -e "\033[1;32mPASS!\033[0m $1"
+}
+
+fail() {
+  echo -e "\033[1;31m$1!\033[0m see $2 for more information"
+  nr_fail=$((nr_fail + 1))
+}
+
+# run the testcases one by one, each with its own log
+run_one_by_one() {
+  for file in $files; do
+    base=`basename $file | sed -e 's/-x86-nemu.bin//'`
+    printf "[%14s] " $base
+    log=build/$base-log.txt
+    $nemu -b -l $ori_log $file &> $log
+    status=$?
+
+    if [ $status -eq 0 ] && grep 'nemu: HIT GOOD TRAP' $log > /dev/null; then
+      pass
+      rm $log
+    else
+      fail "FAIL" $log
+      if (test -e $ori_log) then
+        echo -e "\n\n===== the original log.txt =====\n" >> $log
+        cat $ori_log >> $log
+      fi
     fi
+  done
+}
+
+# run all testcases in parallel, the outputs of failed ones go to $logfile
+$nemu -t $files > $resultfile 2> $logfile
+status=$?
+
+if ! grep -v '^#' $resultfile > /dev/null; then
+  # batch tests are not supported, e.g. in DIFF_TEST mode
+  echo "batch tests are unavailable (exit status $status), running the testcases one by one"
+  run_one_by_one
+else
+  reported=""
+  while IFS=$'\t' read file result instr time mips; do
+    case $file in \#*) continue;; esac
+    reported="$reported $file"
+    base=`basename $file | sed -e 's/-x86-nemu.bin//'`
+    printf "[%14s] " $base
+    if [ "$result" = "PASS" ]; then
+      pass "$instr instr, $mips MIPS"
+    else
+      fail "$result" $logfile
+    fi
+  done < $resultfile
+
+  # NEMU may die before reporting all testcases
+  for file in $files; do
+    case " $reported " in *" $file "*) continue;; esac
+    base=`basename $file | sed -e 's/-x86-nemu.bin//'`
+    printf "[%14s] " $base
+    fail "NO RESULT" $logfile
+  done
+
+  if [ $status -ne 0 ] && [ $nr_fail -eq 0 ]; then
+    echo -e "\033[1;31mNEMU exits with status $status!\033[0m see $logfile for more information"
+    nr_fail=1
   fi
-done
+fi
+
+[ $nr_fail -eq 0 ]
@@ -0,0 +1,137 @@
+#include "cpu/decode-cache.h"
+#include "monitor/monitor.h"
+#include <inttypes.h>
+
+/* The decode cache remembers the result of instruction decoding, indexed
+ * by eip. An entry holds the innermost execution helper and a recipe for
+ * each operand, so a hit only reloads the operand values and runs the
+ * helper, without fetching the instruction bytes or walking opcode_table.
+ *
+ * An entry is stale if
+ * 1. cr0 or cr3 is written (`dcache_epoch' changes), or
+ * 2. the guest writes the physical page the instruction lives in
+ *    (`dcache_page_gen' of that page changes).
+ */
+
+#define NR_DCACHE 16384   // must be a power of 2
+
+/* Each CPU has its own decode cache. The page generations are shared,
+ * so a write by any CPU invalidates the instructions cached by all CPUs.
+ */
+static CPU_LOCAL DecodeCacheEntry dcache[NR_DCACHE];
+static CPU_LOCAL DecodeCacheEntry pending;
+CPU_LOCAL uint32_t dcache_epoch = 1;
+uint32_t dcache_page_gen[NR_PMEM_PAGE];
+uint8_t dcache_code_page[NR_PMEM_PAGE];
+CPU_LOCAL DecodeCacheEntry *dcache_last;
+
+static CPU_LOCAL uint64_t nr_hit, nr_miss, nr_flush, nr_invalidate;
+
+static inline DecodeCacheEntry* dcache_entry(vaddr_t eip) {
+  return &dcache[eip & (NR_DCACHE - 1)];
+}
+
+void decode_cache_flush() {
+  dcache_epoch ++;
+  if (dcache_epoch == 0) {
+    memset(dcache, 0, sizeof(dcache));
+    dcache_epoch = 1;
+  }
+  nr_flush ++;
+}
+
+void decode_cache_invalidate_page(uint32_t ppn) {
+  dcache_page_gen[ppn] ++;
+  dcache_code_page[ppn] = 0;
+  nr_invalidate ++;
+}
+
+static inline void record_operand(OperandRecipe *r, const Operand *op) {
+  r->type = op->type;
+  r->width = op->width;
+  r->load = op->load;
+  r->load_width = op->load_width;
+  switch (op->type) {
+    case OP_TYPE_REG: r->val = op->reg; break;
+    case OP_TYPE_MEM:
+      r->base_reg = op->base_reg;
+      r->index_reg = op->index_reg;
+      r->scale = op->scale;
+      r->val = op->disp;
+      break;
+    default: r->val = op->val; break;
+  }
+}
+
+/* Look up the instruction at `*eip' and execute it on a hit. */
+bool decode_cache_exec(vaddr_t *eip) {
+  DecodeCacheEntry *e = dcache_entry(*eip);
+  if (e->eip != *eip || !decode_cache_is_valid(e->epoch, e->ppn, e->gen)) {
+    return false;
+  }
+  nr_hit ++;
+
+  dcache_last = e;
+  decode_cache_replay(e, eip);
+  return true;
+}
+
+/* Called before a missed instruction is decoded. */
+void decode_cache_begin(vaddr_t eip) {
+  nr_miss ++;
+
+  decoding.src.load = decoding.dest.load = decoding.src2.load = OP_LOAD_NONE;
+  pending.execute = NULL;
+  pending.eip = eip;
+  pending.epoch = dcache_epoch;
+  pending.ppn = page_translate(eip, MEM_FETCH) >> 12;
+  if (pending.ppn < NR_PMEM_PAGE) {
+    /* mark the page before executing, to catch an instruction modifying itself */
+    if (!dcache_code_page[pending.ppn]) {
+      dcache_code_page[pending.ppn] = 1;
+      /* writes to the page must take the slow path from now on */
+      host_tlb_flush_write();
+    }
+    pending.gen = dcache_page_gen[pending.ppn];
+  }
+}
+
+/* Called by idex() right before an execution helper runs. The last call
+ * for an instruction sees the innermost helper with all operands decoded.
+ */
+void decode_cache_record(EHelper execute) {
+  pending.execute = execute;
+  pending.opcode = decoding.opcode;
+  pending.is_operand_size_16 = decoding.is_operand_size_16;
+  pending.jmp_eip = decoding.jmp_eip;
+  pending.len = decoding.seq_eip - pending.eip;
+  record_operand(&pending.src, id_src);
+  record_operand(&pending.dest, id_dest);
+  record_operand(&pending.src2, id_src2);
+}
+
+/* Do not remember the instruction being executed. */
+void decode_cache_skip() {
+  pending.execute = NULL;
+}
+
+/* Called after a missed instruction is executed. */
+void decode_cache_end(vaddr_t eip) {
+  dcache_last = NULL;
+  if (pending.execute == NULL || pending.ppn >= NR_PMEM_PAGE) return;
+  /* do not remember invalid opcodes and traps */
+  if (nemu_state == NEMU_END) return;
+  /* instructions crossing a page boundary are not cached */
+  if ((eip >> 12) != ((eip + pending.len - 1) >> 12)) return;
+
+  dcache_last = dcache_entry(eip);
+  *dcache_last = pending;
+}
+
+void decode_cache_stat() {
+  uint64_t total = nr_hit + nr_miss;
+  printf("decode cache: %" PRIu64 " hits, %" PRIu64 " misses, hit rate %.2f%%\n",
+      nr_hit, nr_miss, total == 0 ? 0.0 : 100.0 * nr_hit / total);
+  printf("              %" PRIu64 " flushes, %" PRIu64 " page invalidations\n",
+      nr_flush, nr_invalidate);
+}
@@ -2,8 +2,8 @@
 #include "cpu/rtl.h"
 
 /* shared by all helper functions */
-DecodeInfo decoding;
-rtlreg_t t0, t1, t2, t3;
+CPU_LOCAL DecodeInfo decoding;
+CPU_LOCAL rtlreg_t t0, t1, t2, t3;
 const rtlreg_t tzero = 0;
 
 #define make_DopHelper(name) void concat(decode_op_, name) (vaddr_t *eip, Operand *op, bool load_val)
@@ -63,6 +63,8 @@ static inline make_DopHelper(a) {
   op->reg = R_EAX;
   if (load_val) {
     rtl_lr(&op->val, R_EAX, op->width);
+    op->load = OP_LOAD_REG;
+    op->load_width = op->width;
   }
 
 #ifdef DEBUG
@@ -79,6 +81,8 @@ static inline make_DopHelper(r) {
   op->reg = decoding.opcode & 0x7;
   if (load_val) {
     rtl_lr(&op->val, op->reg, op->width);
+    op->load = OP_LOAD_REG;
+    op->load_width = op->width;
   }
 
 #ifdef DEBUG
@@ -104,8 +108,12 @@ static inline void decode_op_rm(vaddr_t *eip, Operand *rm, bool load_rm_val, Ope
 static inline make_DopHelper(O) {
   op->type = OP_TYPE_MEM;
   op->addr = instr_fetch(eip, 4);
+  op->base_reg = op->index_reg = -1;
+  op->disp = op->addr;
   if (load_val) {
     rtl_lm(&op->val, &op->addr, op->width);
+    op->load = OP_LOAD_MEM;
+    op->load_width = op->width;
   }
 
 #ifdef DEBUG
@@ -190,6 +198,12 @@ make_DHelper(r) {
   decode_op_r(eip, id_dest, true);
 }
 
+/* used by xchg eXX, eAX */
+make_DHelper(a2r) {
+  decode_op_r(eip, id_dest, true);
+  decode_op_a(eip, id_src, true);
+}
+
 make_DHelper(E) {
   decode_op_rm(eip, id_dest, true, NULL, false);
 }
@@ -238,6 +252,8 @@ make_DHelper(gp2_cl2E) {
   id_src->type = OP_TYPE_REG;
   id_src->reg = R_CL;
   rtl_lr_b(&id_src->val, R_CL);
+  id_src->load = OP_LOAD_REG;
+  id_src->load_width = 1;
 #ifdef DEBUG
   sprintf(id_src->str, "%%cl");
 #endif
@@ -287,6 +303,8 @@ make_DHelper(in_dx2a) {
   id_src->type = OP_TYPE_REG;
   id_src->reg = R_DX;
   rtl_lr_w(&id_src->val, R_DX);
+  id_src->load = OP_LOAD_REG;
+  id_src->load_width = 2;
 #ifdef DEBUG
   sprintf(id_src->str, "(%%dx)");
 #endif
@@ -306,6 +324,8 @@ make_DHelper(out_a2dx) {
   id_dest->type = OP_TYPE_REG;
   id_dest->reg = R_DX;
   rtl_lr_w(&id_dest->val, R_DX);
+  id_dest->load = OP_LOAD_REG;
+  id_dest->load_width = 2;
 #ifdef DEBUG
   sprintf(id_dest->str, "(%%dx)");
 #endif
@@ -324,6 +344,7 @@ make_DHelper(lidt_a){
 make_DHelper(mov_load_cr){
   decode_op_rm(eip,id_dest,false,id_src,false);
   rtl_load_cr(&id_src->val,id_src->reg);
+  id_src->load = OP_LOAD_CR;
 
 #ifdef DEBUG
   snprintf(id_src->str,5,"%%cr%d",id_dest->reg);
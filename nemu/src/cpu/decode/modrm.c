@@ -74,6 +74,10 @@ void load_addr(vaddr_t *eip, ModR_M *m, Operand *rm) {
   }
 #endif
 
+  rm->base_reg = base_reg;
+  rm->index_reg = index_reg;
+  rm->scale = scale;
+  rm->disp = disp;
   rm->type = OP_TYPE_MEM;
 }
 
@@ -86,6 +90,8 @@ void read_ModR_M(vaddr_t *eip, Operand *rm, bool load_rm_val, Operand *reg, bool
     reg->reg = m.reg;
     if (load_reg_val) {
       rtl_lr(&reg->val, reg->reg, reg->width);
+      reg->load = OP_LOAD_REG;
+      reg->load_width = reg->width;
     }
 
 #ifdef DEBUG
@@ -98,6 +104,8 @@ void read_ModR_M(vaddr_t *eip, Operand *rm, bool load_rm_val, Operand *reg, bool
     rm->reg = m.R_M;
     if (load_rm_val) {
       rtl_lr(&rm->val, m.R_M, rm->width);
+      rm->load = OP_LOAD_REG;
+      rm->load_width = rm->width;
     }
 
 #ifdef DEBUG
@@ -108,6 +116,8 @@ void read_ModR_M(vaddr_t *eip, Operand *rm, bool load_rm_val, Operand *reg, bool
     load_addr(eip, &m, rm);
     if (load_rm_val) {
       rtl_lm(&rm->val, &rm->addr, rm->width);
+      rm->load = OP_LOAD_MEM;
+      rm->load_width = rm->width;
     }
   }
 }
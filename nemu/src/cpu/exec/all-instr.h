@@ -1,8 +1,9 @@
 #include "cpu/exec.h"
 
-make_EHelper(mov);
+decl_EHelper_W(mov);
 
 make_EHelper(operand_size);
+make_EHelper(lock);
 
 make_EHelper(inv);
 make_EHelper(nemu_trap);
@@ -10,27 +11,27 @@ make_EHelper(nemu_trap);
 make_EHelper(call);
 make_EHelper(push);
 make_EHelper(pop);
-make_EHelper(sub);
-make_EHelper(xor);
+decl_EHelper_W(sub);
+decl_EHelper_W(xor);
 make_EHelper(ret);
 
 make_EHelper(lea);
-make_EHelper(and);
+decl_EHelper_W(and);
 make_EHelper(nop);
-make_EHelper(add);
-make_EHelper(cmp);
+decl_EHelper_W(add);
+decl_EHelper_W(cmp);
 make_EHelper(setcc);
 make_EHelper(movzx);
-make_EHelper(test);
+decl_EHelper_W(test);
 make_EHelper(jcc);
 make_EHelper(adc);
-make_EHelper(or);
-make_EHelper(shl);
-make_EHelper(shr);
-make_EHelper(sar);
-make_EHelper(dec);
+decl_EHelper_W(or);
+decl_EHelper_W(shl);
+decl_EHelper_W(shr);
+decl_EHelper_W(sar);
+decl_EHelper_W(dec);
 make_EHelper(not);
-make_EHelper(inc);
+decl_EHelper_W(inc);
 make_EHelper(jmp);
 make_EHelper(jmp_rm);
 make_EHelper(imul1);
@@ -40,6 +41,8 @@ make_EHelper(cltd);
 make_EHelper(idiv);
 make_EHelper(movsx);
 make_EHelper(leave);
+make_EHelper(xchg);
+make_EHelper(cmpxchg);
 make_EHelper(call_rm);
 make_EHelper(sbb);
 make_EHelper(div);
@@ -52,6 +55,7 @@ make_EHelper(in);
 make_EHelper(out);
 
 make_EHelper(lidt);
+make_EHelper(invlpg);
 make_EHelper(int);
 make_EHelper(pusha);
 make_EHelper(popa);
@@ -1,86 +1,50 @@
 #include "cpu/exec.h"
 
-static inline void eflags_modify(){
-  rtl_sub(&t2,&id_dest->val,&id_src->val);
-
-  //ZF SF
-  rtl_update_ZFSF(&t2,id_dest->width);
-
-  //CF
-  //CF=1的判断：作为无符号数的被减数小于同样无符号数的减数
-  rtl_sltu(&t0,&id_dest->val,&id_src->val);
-  rtl_set_CF(&t0);
-
-  //OF
-  //OF的判断：正-负=负 或 负-正=正 时为发生溢出，使用最高位判断正负
-  //即被减数同时与 减数/差 异号
-  rtl_xor(&t0,&id_dest->val,&id_src->val);
-  rtl_xor(&t1,&id_dest->val,&t2);//t2里是差
-  rtl_and(&t0,&t0,&t1);
-  rtl_msb(&t0,&t0,id_dest->width);
-  rtl_set_OF(&t0);
-}
-
-make_EHelper(add) {
+make_EHelper_W(add) {
   //TODO();
   
   rtl_add(&t2,&id_dest->val,&id_src->val);
-  operand_write(id_dest,&t2);
-
-  rtl_update_ZFSF(&t2,id_dest->width);
+  operand_write_w(id_dest,&t2,width);
 
-  //CF=1的判断：1+1=0（进位），即当无符号数比较，结果<任一加数时，CF=1
-  rtl_sltu(&t0,&t2,&id_dest->val);
-  rtl_set_CF(&t0);
-
-  //OF的判断：正+正=负 或 负+负=正 时为发生溢出（使用最高位来判断正负），即结果同时与两个加数异号
-  rtl_xor(&t0,&id_src->val,&t2);
-  rtl_xor(&t1,&id_dest->val,&t2);
-  rtl_and(&t0,&t0,&t1);
-  rtl_msb(&t0,&t0,id_dest->width);//取表示正负的最高位
-  rtl_set_OF(&t0);
-  
+  rtl_set_cc(CC_OP_ADD,&id_dest->val,&id_src->val,&t2,width);
 
   print_asm_template2(add);
 }
 
-make_EHelper(sub) {
+make_EHelper_W(sub) {
   //TODO();
-  eflags_modify();
-  operand_write(id_dest,&t2);
+  rtl_sub(&t2,&id_dest->val,&id_src->val);
+  operand_write_w(id_dest,&t2,width);
+
+  rtl_set_cc(CC_OP_SUB,&id_dest->val,&id_src->val,&t2,width);
 
   print_asm_template2(sub);
 }
 
-make_EHelper(cmp) {
+make_EHelper_W(cmp) {
   //TODO();
-  eflags_modify();
+  rtl_sub(&t2,&id_dest->val,&id_src->val);
+  rtl_set_cc(CC_OP_SUB,&id_dest->val,&id_src->val,&t2,width);
 
   print_asm_template2(cmp);
 }
 
-make_EHelper(inc) {
+make_EHelper_W(inc) {
   //TODO();
   rtl_addi(&t2,&id_dest->val,1);
-  operand_write(id_dest,&t2);
+  operand_write_w(id_dest,&t2,width);
 
-  rtl_update_ZFSF(&t2,id_dest->width);
-
-  rtl_eqi(&t0,&t2,0x80000000);
-  rtl_set_OF(&t0);
+  rtl_set_cc(CC_OP_INC,&id_dest->val,&tzero,&t2,width);
 
   print_asm_template1(inc);
 }
 
-make_EHelper(dec) {
+make_EHelper_W(dec) {
   //TODO();
   rtl_subi(&t2,&id_dest->val,1);
-  operand_write(id_dest,&t2);
+  operand_write_w(id_dest,&t2,width);
 
-  rtl_update_ZFSF(&t2,id_dest->width);
-
-  rtl_eqi(&t0,&t2,0x7fffffff);
-  rtl_set_OF(&t0);
+  rtl_set_cc(CC_OP_DEC,&id_dest->val,&tzero,&t2,width);
 
   print_asm_template1(dec);
 }
@@ -88,14 +52,7 @@ make_EHelper(dec) {
 make_EHelper(neg) {
   //TODO();
   rtl_sub(&t2,&tzero,&id_dest->val);
-
-  rtl_update_ZFSF(&t2,id_dest->width);
-
-  rtl_neq0(&t0,&id_dest->val);
-  rtl_set_CF(&t0);
-
-  rtl_eqi(&t0,&id_dest->val,0x80000000);
-  rtl_set_OF(&t0);
+  rtl_set_cc(CC_OP_SUB,&tzero,&id_dest->val,&t2,id_dest->width);
 
   operand_write(id_dest,&t2);
 
@@ -0,0 +1,203 @@
+#include "cpu/block.h"
+#include "monitor/monitor.h"
+#include "all-instr.h"
+#include <inttypes.h>
+
+/* The block engine runs the guest one basic block at a time. A block is
+ * recorded the first time it is executed: its instructions run through
+ * exec_wrapper() as usual, and their decode cache entries are copied
+ * into a threaded-code array, until an instruction which transfers
+ * control. Later executions replay the array directly, and only return
+ * to cpu_exec() at the end of the block.
+ *
+ * A block never crosses a page boundary, so it is validated like a
+ * decode cache entry. Each block also remembers the blocks following it,
+ * so the next block is usually found without a table lookup.
+ */
+
+/* translate a block to host code after it is executed this many times */
+#define JIT_THRESHOLD 16
+
+typedef struct Block {
+  vaddr_t eip;
+  uint32_t epoch;
+  uint32_t ppn;
+  uint32_t gen;
+  int len;
+  DecodeCacheEntry *instr;
+  struct Block *next[2];
+#ifdef JIT
+  uint32_t nr_run;
+  void *code;
+#endif
+} Block;
+
+static CPU_LOCAL Block blocks[NR_BLOCK];
+static CPU_LOCAL DecodeCacheEntry pool[BLOCK_POOL_SIZE];
+static CPU_LOCAL int pool_used = 0;
+
+/* the last executed block, used to chain its successors */
+static CPU_LOCAL Block *last = NULL;
+
+static CPU_LOCAL uint64_t nr_build, nr_exec, nr_chain, nr_instr;
+
+void exec_wrapper(bool);
+void check_intr(void);
+
+static inline bool block_is_valid(Block *b) {
+  return b->len > 0 && decode_cache_is_valid(b->epoch, b->ppn, b->gen);
+}
+
+static inline bool is_block_end(EHelper execute) {
+  return execute == exec_jmp || execute == exec_jcc || execute == exec_jmp_rm ||
+    execute == exec_call || execute == exec_call_rm || execute == exec_ret ||
+    execute == exec_int || execute == exec_iret ||
+    /* stop NEMU or change the address space */
+    execute == exec_nemu_trap || execute == exec_mov_store_cr || execute == exec_invlpg;
+}
+
+static void block_flush(void) {
+  memset(blocks, 0, sizeof(blocks));
+  pool_used = 0;
+  last = NULL;
+#ifdef JIT
+  jit_flush();
+#endif
+}
+
+static inline Block* block_find(vaddr_t eip) {
+  Block *b;
+  int i;
+  if (last != NULL) {
+    for (i = 0; i < 2; i ++) {
+      b = last->next[i];
+      if (b != NULL && b->eip == eip && block_is_valid(b)) {
+        nr_chain ++;
+        return b;
+      }
+    }
+  }
+
+  b = &blocks[eip & (NR_BLOCK - 1)];
+  if (b->eip != eip || !block_is_valid(b)) {
+    return NULL;
+  }
+
+  if (last != NULL) {
+    /* chain it to the previous block */
+    last->next[last->next[0] == NULL ? 0 : 1] = b;
+  }
+  return b;
+}
+
+/* Execute at most n instructions from eip, recording them as a block. */
+static uint32_t block_build(vaddr_t eip, uint64_t n) {
+  if (pool_used + MAX_BLOCK_LEN > BLOCK_POOL_SIZE) {
+    block_flush();
+  }
+
+  Block *b = &blocks[eip & (NR_BLOCK - 1)];
+  b->eip = eip;
+  b->len = 0;
+  b->instr = &pool[pool_used];
+  b->next[0] = b->next[1] = NULL;
+#ifdef JIT
+  b->nr_run = 0;
+  b->code = NULL;
+#endif
+  nr_build ++;
+
+  uint32_t count = 0;
+  while (count < n && b->len < MAX_BLOCK_LEN) {
+    vaddr_t instr_eip = cpu.eip;
+    exec_wrapper(false);
+    count ++;
+
+    DecodeCacheEntry *e = dcache_last;
+    if (e == NULL) break;
+    if (b->len == 0) {
+      b->epoch = e->epoch;
+      b->ppn = e->ppn;
+      b->gen = e->gen;
+    }
+    else if (e->epoch != b->epoch || e->ppn != b->ppn || e->gen != b->gen) {
+      break;
+    }
+
+    b->instr[b->len ++] = *e;
+    if (is_block_end(e->execute) || nemu_state != NEMU_RUNNING) break;
+    /* an interrupt is taken */
+    if (cpu.eip != instr_eip + e->len) break;
+  }
+
+  pool_used += b->len;
+  last = NULL;
+  return count;
+}
+
+/* Execute a block, or at most n instructions. Return the number of
+ * instructions executed.
+ */
+uint32_t exec_block(uint64_t n) {
+  Block *b = block_find(cpu.eip);
+  if (b == NULL) {
+    return block_build(cpu.eip, n);
+  }
+  if (b->len > n) {
+    last = NULL;
+    exec_wrapper(false);
+    return 1;
+  }
+
+  int i = 0;
+#ifdef JIT
+  if (b->code == NULL && ++ b->nr_run >= JIT_THRESHOLD) {
+    b->code = jit_translate(b->instr, b->len);
+  }
+  if (b->code != NULL) {
+    i = jit_exec(b->code, b->epoch, b->ppn, b->gen);
+  }
+  else
+#endif
+  while (i < b->len) {
+    DecodeCacheEntry *e = &b->instr[i ++];
+    decoding.seq_eip = cpu.eip;
+#ifdef ITRACE
+    itrace_begin(cpu.eip);
+#endif
+#ifdef OPCODE_STAT
+    opstat_begin();
+#endif
+#ifdef CACHE_SIM
+    cache_instr_begin(e->eip);
+    cache_ifetch((e->ppn << 12) | (e->eip & 0xfff), e->len);
+#endif
+    decode_cache_replay(e, &decoding.seq_eip);
+#ifdef OPCODE_STAT
+    opstat_end(e);
+#endif
+#ifdef ITRACE
+    itrace_end(e->len);
+#endif
+    cpu.eip = (decoding.is_jmp ? (decoding.is_jmp = 0, decoding.jmp_eip) : decoding.seq_eip);
+
+    /* the block may be modified by itself, or NEMU stopped by a memory
+     * watchpoint */
+    if (!block_is_valid(b) || nemu_state != NEMU_RUNNING) break;
+  }
+
+  check_intr();
+
+  nr_exec ++;
+  nr_instr += i;
+  last = b;
+  return i;
+}
+
+void block_stat() {
+  printf("blocks: %" PRIu64 " built, %" PRIu64 " executed, %" PRIu64 " chained, %.2f instructions per block\n",
+      nr_build, nr_exec, nr_chain, nr_exec == 0 ? 0.0 : (double)nr_instr / nr_exec);
+#ifdef JIT
+  jit_stat();
+#endif
+}
@@ -0,0 +1,179 @@
+#include "cpu/exec.h"
+#include "cpu/branch-pred.h"
+
+#ifdef BRANCH_SIM
+
+#include "monitor/symbol.h"
+#include "monitor/stat.h"
+#include <inttypes.h>
+#include <stdlib.h>
+
+static const char *kind_name[] = { "jcc", "jmp", "call", "jmp_rm", "call_rm", "ret" };
+
+/* 2-bit saturating counters, taken if >= 2 */
+static uint8_t bimodal[1 << BP_BIMODAL_BITS];
+static uint8_t gshare[1 << BP_GSHARE_BITS];
+static uint32_t history = 0;
+
+static struct {
+  vaddr_t eip;   // 0 if invalid
+  vaddr_t target;
+} btb[1 << BP_BTB_BITS];
+
+/* a circular stack, the oldest return addresses are overwritten */
+static vaddr_t ras[BP_RAS_DEPTH];
+static uint32_t ras_top = 0;
+
+/* the statistics of a static branch, keyed by eip */
+typedef struct {
+  vaddr_t eip;
+  uint8_t kind;
+  uint64_t count;
+  uint64_t taken;
+  uint64_t bimodal_miss, gshare_miss;
+  uint64_t target_miss;   // BTB misses, or ras misses of ret
+} BranchStat;
+
+static StatTable stats;
+
+static inline bool counter_predict(uint8_t c) {
+  return c >= 2;
+}
+
+static inline void counter_update(uint8_t *c, bool taken) {
+  if (taken && *c < 3) (*c) ++;
+  else if (!taken && *c > 0) (*c) --;
+}
+
+/* Return true if the BTB has the target of the branch, then update it. */
+static bool btb_lookup(vaddr_t eip, vaddr_t target) {
+  uint32_t i = eip & ((1 << BP_BTB_BITS) - 1);
+  bool hit = (btb[i].eip == eip && btb[i].target == target);
+  btb[i].eip = eip;
+  btb[i].target = target;
+  return hit;
+}
+
+void bpred_branch(int kind, vaddr_t eip, vaddr_t next, vaddr_t target, bool taken) {
+  if (!stat_is_traced()) return;
+
+  BranchStat *s = stat_entry(&stats, stat_get(&stats, &eip));
+  if (s->count == 0) s->kind = kind;
+  s->count ++;
+  s->taken += taken;
+
+  switch (kind) {
+    case BP_JCC: {
+      uint8_t *b = &bimodal[eip & ((1 << BP_BIMODAL_BITS) - 1)];
+      uint8_t *g = &gshare[(eip ^ history) & ((1 << BP_GSHARE_BITS) - 1)];
+      s->bimodal_miss += (counter_predict(*b) != taken);
+      s->gshare_miss += (counter_predict(*g) != taken);
+      counter_update(b, taken);
+      counter_update(g, taken);
+      history = ((history << 1) | taken) & ((1 << BP_GSHARE_BITS) - 1);
+      if (taken) s->target_miss += !btb_lookup(eip, target);
+      break;
+    }
+    case BP_RET:
+      ras_top = (ras_top + BP_RAS_DEPTH - 1) % BP_RAS_DEPTH;
+      s->target_miss += (ras[ras_top] != target);
+      break;
+    case BP_CALL: case BP_CALL_RM:
+      ras[ras_top] = next;
+      ras_top = (ras_top + 1) % BP_RAS_DEPTH;
+      /* fall through */
+    default:
+      s->target_miss += !btb_lookup(eip, target);
+      break;
+  }
+}
+
+/* the mispredictions counted by hardware */
+static uint64_t mispredictions(const BranchStat *s) {
+  switch (s->kind) {
+    case BP_JCC: return s->gshare_miss;
+    case BP_JMP: case BP_CALL: return 0;
+    default: return s->target_miss;
+  }
+}
+
+static int stat_cmp(const void *a, const void *b) {
+  const BranchStat *x = a, *y = b;
+  uint64_t mx = mispredictions(x), my = mispredictions(y);
+  if (mx != my) return (mx < my) - (mx > my);
+  return (x->count < y->count) - (x->count > y->count);
+}
+
+/* Print the rates by kind of branch, and the `top' static branches with
+ * the most mispredictions.
+ */
+void bpred_report(int top) {
+  BranchStat sum[NR_BP_KIND];
+  memset(sum, 0, sizeof(sum));
+  uint64_t total = 0, total_miss = 0;
+  uint32_t i;
+  for (i = 0; i < stats.nr; i ++) {
+    BranchStat *s = stat_entry(&stats, i);
+    BranchStat *k = &sum[s->kind];
+    k->count += s->count;
+    k->taken += s->taken;
+    k->bimodal_miss += s->bimodal_miss;
+    k->gshare_miss += s->gshare_miss;
+    k->target_miss += s->target_miss;
+    total += s->count;
+    total_miss += mispredictions(s);
+  }
+  if (total == 0) {
+    printf("No branches executed yet\n");
+    return;
+  }
+
+  printf("%" PRIu64 " branches, %" PRIu64 " mispredicted (%.2f%%), %u static branches\n",
+      total, total_miss, ratio(total_miss, total), stats.nr);
+  printf("kind             count   taken%%  bimodal%%  gshare%%  target%%\n");
+  int k;
+  for (k = 0; k < NR_BP_KIND; k ++) {
+    BranchStat *s = &sum[k];
+    if (s->count == 0) continue;
+    uint64_t targets = (k == BP_JCC ? s->taken : s->count);
+    printf("%-8s %14" PRIu64 "  %7.2f  %8.2f  %7.2f  %7.2f\n", kind_name[k], s->count,
+        ratio(s->taken, s->count), ratio(s->bimodal_miss, s->count),
+        ratio(s->gshare_miss, s->count), ratio(s->target_miss, targets));
+  }
+
+  BranchStat *sorted = malloc(sizeof(*sorted) * (stats.nr + 1));
+  assert(sorted != NULL);
+  memcpy(sorted, stats.entries, sizeof(*sorted) * stats.nr);
+  int n = stats.nr;
+  qsort(sorted, n, sizeof(*sorted), stat_cmp);
+
+  printf("\n     eip  kind             count   taken%%  bimodal%%  gshare%%  target%%  location\n");
+  for (k = 0; k < n && k < top; k ++) {
+    BranchStat *s = &sorted[k];
+    if (mispredictions(s) == 0) break;
+    uint64_t targets = (s->kind == BP_JCC ? s->taken : s->count);
+    vaddr_t start;
+    char buf[SYMBOL_BUF_LEN];
+    const char *name = symbol_name(s->eip, &start, buf);
+    printf("%08x  %-8s %14" PRIu64 "  %7.2f  %8.2f  %7.2f  %7.2f  ", s->eip, kind_name[s->kind],
+        s->count, ratio(s->taken, s->count), ratio(s->bimodal_miss, s->count),
+        ratio(s->gshare_miss, s->count), ratio(s->target_miss, targets));
+    if (s->eip != start) printf("%s+0x%x\n", name, s->eip - start);
+    else printf("%s\n", name);
+  }
+  free(sorted);
+}
+
+static void bpred_exit() {
+  bpred_report(30);
+}
+
+/* Counters start weakly taken. Report at exit. */
+void init_bpred() {
+  memset(bimodal, 2, sizeof(bimodal));
+  memset(gshare, 2, sizeof(gshare));
+  stat_table_init(&stats, sizeof(BranchStat), sizeof(vaddr_t));
+  atexit(bpred_exit);
+}
+
+#endif
@@ -1,5 +1,52 @@
 #include "cpu/rtl.h"
 
+/* Lazy eflags */
+
+void rtl_cc_materialize() {
+  uint32_t width = cpu.cc.width;
+  uint32_t mask = 0xffffffffu >> ((4 - width) * 8);
+  uint32_t sign = 1u << (width * 8 - 1);
+  uint32_t dest = cpu.cc.dest & mask, src = cpu.cc.src & mask, res = cpu.cc.res & mask;
+
+  cpu.eflags.ZF = (res == 0);
+  cpu.eflags.SF = ((res & sign) != 0);
+  switch (cpu.cc.op) {
+    case CC_OP_ADD:
+      cpu.eflags.CF = (res < dest);
+      cpu.eflags.OF = (((dest ^ res) & (src ^ res) & sign) != 0);
+      break;
+    case CC_OP_SUB:
+      cpu.eflags.CF = (dest < src);
+      cpu.eflags.OF = (((dest ^ src) & (dest ^ res) & sign) != 0);
+      break;
+    case CC_OP_LOGIC:
+      cpu.eflags.CF = 0;
+      cpu.eflags.OF = 0;
+      break;
+    case CC_OP_INC: cpu.eflags.OF = (res == sign); break;
+    case CC_OP_DEC: cpu.eflags.OF = (res == sign - 1); break;
+    case CC_OP_ZFSF: break;
+    default: panic("should not reach here");
+  }
+  cpu.cc.op = CC_OP_NONE;
+}
+
+/* Evaluate a condition right after cmp or sub, without touching eflags. */
+static inline bool setcc_sub(uint8_t cc) {
+  uint32_t shift = (4 - cpu.cc.width) * 8;
+  uint32_t dest = cpu.cc.dest << shift, src = cpu.cc.src << shift, res = cpu.cc.res << shift;
+  switch (cc) {
+    case 0x0: return ((dest ^ src) & (dest ^ res)) >> 31;   // O
+    case 0x2: return dest < src;                            // B
+    case 0x4: return dest == src;                           // E
+    case 0x6: return dest <= src;                           // BE
+    case 0x8: return res >> 31;                             // S
+    case 0xc: return (int32_t)dest < (int32_t)src;          // L
+    case 0xe: return (int32_t)dest <= (int32_t)src;         // LE
+    default: panic("n86 does not have PF");
+  }
+}
+
 /* Condition Code */
 
 void rtl_setcc(rtlreg_t* dest, uint8_t subcode) {
@@ -11,6 +58,11 @@ void rtl_setcc(rtlreg_t* dest, uint8_t subcode) {
     CC_L, CC_NL, CC_LE, CC_NLE
   };
 
+  if (cpu.cc.op == CC_OP_SUB) {
+    rtl_li(dest, setcc_sub(subcode & 0xe) ^ invert);
+    return;
+  }
+
   // TODO: Query EFLAGS to determine whether the condition code is satisfied.
   // dest <- ( cc is satisfied ? 1 : 0)
   switch (subcode & 0xe) {
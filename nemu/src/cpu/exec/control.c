@@ -1,8 +1,13 @@
 #include "cpu/exec.h"
+#include "monitor/ftrace.h"
+#include "cpu/branch-pred.h"
 
 make_EHelper(jmp) {
   // the target address is calculated at the decode stage
   decoding.is_jmp = 1;
+#ifdef BRANCH_SIM
+  bpred_branch(BP_JMP, cpu.eip, decoding.seq_eip, decoding.jmp_eip, true);
+#endif
 
   print_asm("jmp %x", decoding.jmp_eip);
 }
@@ -12,6 +17,9 @@ make_EHelper(jcc) {
   uint8_t subcode = decoding.opcode & 0xf;
   rtl_setcc(&t2, subcode);
   decoding.is_jmp = t2;
+#ifdef BRANCH_SIM
+  bpred_branch(BP_JCC, cpu.eip, decoding.seq_eip, decoding.jmp_eip, t2);
+#endif
 
   print_asm("j%s %x", get_cc_name(subcode), decoding.jmp_eip);
 }
@@ -19,6 +27,9 @@ make_EHelper(jcc) {
 make_EHelper(jmp_rm) {
   decoding.jmp_eip = id_dest->val;
   decoding.is_jmp = 1;
+#ifdef BRANCH_SIM
+  bpred_branch(BP_JMP_RM, cpu.eip, decoding.seq_eip, decoding.jmp_eip, true);
+#endif
 
   print_asm("jmp *%s", id_dest->str);
 }
@@ -29,6 +40,10 @@ make_EHelper(call) {
   rtl_li(&t2,decoding.seq_eip);
   rtl_push(&t2);//为什么不直接push(seq_eip)? 因为push()参数是指针，seq_eip是uint32_t
   decoding.is_jmp=1;
+  ftrace_hook(FTRACE_CALL, decoding.seq_eip, decoding.jmp_eip, cpu.esp);
+#ifdef BRANCH_SIM
+  bpred_branch(BP_CALL, cpu.eip, decoding.seq_eip, decoding.jmp_eip, true);
+#endif
 
   print_asm("call %x", decoding.jmp_eip);
 }
@@ -38,6 +53,10 @@ make_EHelper(ret) {
   rtl_pop(&t2);
   decoding.jmp_eip=t2;
   decoding.is_jmp=1;
+  ftrace_hook(FTRACE_RET, t2, 0, cpu.esp - 4);
+#ifdef BRANCH_SIM
+  bpred_branch(BP_RET, cpu.eip, decoding.seq_eip, t2, true);
+#endif
 
   print_asm("ret");
 }
@@ -48,6 +67,10 @@ make_EHelper(call_rm) {
   rtl_push(&t2);
   decoding.jmp_eip=id_dest->val;
   decoding.is_jmp=1;
+  ftrace_hook(FTRACE_CALL, decoding.seq_eip, decoding.jmp_eip, cpu.esp);
+#ifdef BRANCH_SIM
+  bpred_branch(BP_CALL_RM, cpu.eip, decoding.seq_eip, decoding.jmp_eip, true);
+#endif
 
   print_asm("call *%s", id_dest->str);
 }
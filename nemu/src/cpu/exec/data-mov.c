@@ -1,7 +1,7 @@
 #include "cpu/exec.h"
 
-make_EHelper(mov) {
-  operand_write(id_dest, &id_src->val);
+make_EHelper_W(mov) {
+  operand_write_w(id_dest,&id_src->val,width);
   print_asm_template2(mov);
 }
 
@@ -47,6 +47,43 @@ make_EHelper(popa) {
   print_asm("popa");
 }
 
+/* A memory operand is exchanged atomically under the bus lock, see
+ * vaddr_xchg(). */
+make_EHelper(xchg) {
+  if (id_dest->type == OP_TYPE_MEM) {
+    t0 = vaddr_xchg(id_dest->addr, id_dest->width, id_src->val);
+  }
+  else {
+    rtl_mv(&t0, &id_dest->val);
+    operand_write(id_dest, &id_src->val);
+  }
+  operand_write(id_src, &t0);
+
+  print_asm_template2(xchg);
+}
+
+make_EHelper(cmpxchg) {
+  rtl_lr(&t1, R_EAX, id_dest->width);
+  if (id_dest->type == OP_TYPE_MEM) {
+    t0 = vaddr_cmpxchg(id_dest->addr, id_dest->width, t1, id_src->val);
+  }
+  else {
+    rtl_mv(&t0, &id_dest->val);
+    if (t0 == t1) {
+      operand_write(id_dest, &id_src->val);
+    }
+  }
+
+  /* the flags are set as `cmp' of the accumulator and the old value */
+  rtl_sub(&t2, &t1, &t0);
+  rtl_set_cc(CC_OP_SUB, &t1, &t0, &t2, id_dest->width);
+  if (t0 != t1) {
+    rtl_sr(R_EAX, id_dest->width, &t0);
+  }
+
+  print_asm_template2(cmpxchg);
+}
+
 make_EHelper(leave) {
   //TODO();
   rtl_mv(&cpu.esp,&cpu.ebp);
@@ -1,4 +1,6 @@
 #include "cpu/exec.h"
+#include "cpu/decode-cache.h"
+#include "monitor/diff-test.h"
 #include "all-instr.h"
 
 #define TIME_IRQ 32 //PA4
@@ -22,11 +24,47 @@ static inline void set_width(int width) {
   decoding.src.width = decoding.dest.width = decoding.src2.width = width;
 }
 
+#ifdef DECODE_CACHE
+#define SPEC(name) { concat(exec_, name), { \
+  concat3(exec_, name, _b), concat3(exec_, name, _w), concat3(exec_, name, _l) } }
+
+/* execution helpers defined with make_EHelper_W() */
+static const struct {
+  EHelper generic;
+  EHelper spec[3];   // indexed by width >> 1
+} spec_table[] = {
+  SPEC(mov), SPEC(add), SPEC(sub), SPEC(cmp), SPEC(inc), SPEC(dec),
+  SPEC(and), SPEC(or), SPEC(xor), SPEC(test), SPEC(shl), SPEC(shr), SPEC(sar),
+};
+
+#define NR_SPEC (sizeof(spec_table) / sizeof(spec_table[0]))
+
+/* Return the copy of `execute' specialized for `width', if any. */
+static EHelper specialize(EHelper execute, int width) {
+  int i;
+  for (i = 0; i < NR_SPEC; i ++) {
+    if (spec_table[i].generic == execute) {
+      return spec_table[i].spec[width >> 1];
+    }
+  }
+  return execute;
+}
+#endif
+
 /* Instruction Decode and EXecute */
 static inline void idex(vaddr_t *eip, opcode_entry *e) {
   /* eip is pointing to the byte next to opcode */
+#ifdef OPCODE_STAT
+  uint64_t t = opstat_decode_begin();
+#endif
   if (e->decode)
     e->decode(eip);
+#ifdef OPCODE_STAT
+  opstat_decode_end(t);
+#endif
+#ifdef DECODE_CACHE
+  decode_cache_record(specialize(e->execute, id_dest->width));
+#endif
   e->execute(eip);
 }
 
@@ -69,7 +107,7 @@ make_group(gp5,
   /* 0x0f 0x01*/
 make_group(gp7,
     EMPTY, EMPTY, EMPTY, IDEX(lidt_a,lidt),
-    EMPTY, EMPTY, EMPTY, EMPTY)
+    EMPTY, EMPTY, EMPTY, EX(invlpg))
 
 /* TODO: Add more instructions!!! */
 
@@ -107,11 +145,11 @@ opcode_entry opcode_table [512] = {
   /* 0x78 */	IDEXW(J,jcc,1), IDEXW(J,jcc,1), IDEXW(J,jcc,1), IDEXW(J,jcc,1),
   /* 0x7c */	IDEXW(J,jcc,1), IDEXW(J,jcc,1), IDEXW(J,jcc,1), IDEXW(J,jcc,1),
   /* 0x80 */	IDEXW(I2E, gp1, 1), IDEX(I2E, gp1), EMPTY, IDEX(SI2E, gp1),
-  /* 0x84 */	IDEXW(G2E,test,1), IDEX(G2E,test), EMPTY, EMPTY,
+  /* 0x84 */	IDEXW(G2E,test,1), IDEX(G2E,test), IDEXW(G2E,xchg,1), IDEX(G2E,xchg),
   /* 0x88 */	IDEXW(mov_G2E, mov, 1), IDEX(mov_G2E, mov), IDEXW(mov_E2G, mov, 1), IDEX(mov_E2G, mov),
   /* 0x8c */	EMPTY, IDEX(lea_M2G,lea), EMPTY, EMPTY,
-  /* 0x90 */	EX(nop), EMPTY, EMPTY, EMPTY,
-  /* 0x94 */	EMPTY, EMPTY, EMPTY, EMPTY,
+  /* 0x90 */	EX(nop), IDEX(a2r,xchg), IDEX(a2r,xchg), IDEX(a2r,xchg),
+  /* 0x94 */	IDEX(a2r,xchg), IDEX(a2r,xchg), IDEX(a2r,xchg), IDEX(a2r,xchg),
   /* 0x98 */	EX(cwtl), EX(cltd), EMPTY, EMPTY,
   /* 0x9c */	EMPTY, EMPTY, EMPTY, EMPTY,
   /* 0xa0 */	IDEXW(O2a, mov, 1), IDEX(O2a, mov), IDEXW(a2O, mov, 1), IDEX(a2O, mov),
@@ -134,7 +172,7 @@ opcode_entry opcode_table [512] = {
   /* 0xe4 */	IDEXW(in_I2a,in,1), IDEXW(in_I2a,in,1), IDEXW(out_a2I,out,1), IDEXW(out_a2I,out,1),
   /* 0xe8 */	IDEX(J,call), IDEX(J,jmp), EMPTY, IDEXW(J,jmp,1),
   /* 0xec */	IDEXW(in_dx2a,in,1), IDEX(in_dx2a,in), IDEXW(out_a2dx,out,1), IDEX(out_a2dx,out),
-  /* 0xf0 */	EMPTY, EMPTY, EMPTY, EMPTY,
+  /* 0xf0 */	EX(lock), EMPTY, EMPTY, EMPTY,
   /* 0xf4 */	EMPTY, EMPTY, IDEXW(E, gp3, 1), IDEX(E, gp3),
   /* 0xf8 */	EMPTY, EMPTY, EMPTY, EMPTY,
   /* 0xfc */	EMPTY, EMPTY, IDEXW(E, gp4, 1), IDEX(E, gp5),
@@ -185,7 +223,7 @@ opcode_entry opcode_table [512] = {
   /* 0xa4 */	EMPTY, EMPTY, EMPTY, EMPTY,
   /* 0xa8 */	EMPTY, EMPTY, EMPTY, EMPTY,
   /* 0xac */	EMPTY, EMPTY, EMPTY, IDEX(E2G,imul2),
-  /* 0xb0 */	EMPTY, EMPTY, EMPTY, EMPTY,
+  /* 0xb0 */	IDEXW(G2E,cmpxchg,1), IDEX(G2E,cmpxchg), EMPTY, EMPTY,
   /* 0xb4 */	EMPTY, EMPTY, IDEXW(mov_E2G,movzx,1), IDEXW(mov_E2G,movzx,2),
   /* 0xb8 */	EMPTY, EMPTY, EMPTY, EMPTY,
   /* 0xbc */	EMPTY, EMPTY, IDEXW(mov_E2G,movsx,1), IDEXW(mov_E2G,movsx,2),
@@ -225,40 +263,102 @@ static inline void update_eip(void) {
   cpu.eip = (decoding.is_jmp ? (decoding.is_jmp = 0, decoding.jmp_eip) : decoding.seq_eip);
 }
 
-void exec_wrapper(bool print_flag) {
-#ifdef DEBUG
-  decoding.p = decoding.asm_buf;
-  decoding.p += sprintf(decoding.p, "%8x:   ", cpu.eip);
+/* respond to the pending timer interrupt, if any */
+void check_intr(void) {
+  if(cpu.INTR & cpu.eflags.IF){
+    cpu.INTR=false;
+    extern void raise_intr(uint8_t NO, vaddr_t ret_addr);
+    raise_intr(TIME_IRQ,cpu.eip);
+    update_eip();
+#ifdef DIFF_TEST
+    difftest_intr(TIME_IRQ);
 #endif
+  }
+}
 
+/* Execute an instruction for the in-process reference of differential
+ * testing, which never uses the decode cache.
+ */
+void exec_ref(void) {
   decoding.seq_eip = cpu.eip;
   exec_real(&decoding.seq_eip);
+  update_eip();
+}
 
+/* Take the interrupt NEMU has taken. */
+void exec_ref_intr(uint8_t NO) {
+  extern void raise_intr(uint8_t NO, vaddr_t ret_addr);
+  raise_intr(NO, cpu.eip);
+  update_eip();
+}
+
+void exec_wrapper(bool print_flag) {
 #ifdef DEBUG
-  int instr_len = decoding.seq_eip - cpu.eip;
-  sprintf(decoding.p, "%*.s", 50 - (12 + 3 * instr_len), "");
-  strcat(decoding.asm_buf, decoding.assembly);
-  Log_write("%s\n", decoding.asm_buf);
+  /* Formatting each instruction is slow, it is left to the `si' command.
+   * Use the instruction trace to see the others. */
+  decoding.p = NULL;
   if (print_flag) {
-    puts(decoding.asm_buf);
+    decoding.p = decoding.asm_buf;
+    decoding.p += sprintf(decoding.p, "%8x:   ", cpu.eip);
   }
 #endif
+#ifdef ITRACE
+  itrace_begin(cpu.eip);
+#endif
+#ifdef OPCODE_STAT
+  opstat_begin();
+  const DecodeCacheEntry *cached = NULL;
+#endif
+#ifdef CACHE_SIM
+  cache_instr_begin(cpu.eip);
+  paddr_t fetch_addr = page_translate(cpu.eip, MEM_FETCH);
+#endif
 
-#ifdef DIFF_TEST
-  uint32_t eip = cpu.eip;
+  decoding.seq_eip = cpu.eip;
+#ifdef DECODE_CACHE
+  if (!decode_cache_exec(&decoding.seq_eip)) {
+    decode_cache_begin(cpu.eip);
+    exec_real(&decoding.seq_eip);
+    decode_cache_end(cpu.eip);
+  }
+#ifdef OPCODE_STAT
+  else cached = dcache_last;
+#endif
+#else
+  exec_real(&decoding.seq_eip);
 #endif
 
-  update_eip();
+#ifdef OPCODE_STAT
+  opstat_end(cached);
+#endif
 
-#ifdef DIFF_TEST
-  void difftest_step(uint32_t);
-  difftest_step(eip);
+#if defined(CACHE_SIM) || defined(ITRACE)
+  /* the length of the instruction if it is in the decode cache, 0 if
+   * unknown, as iret changes seq_eip */
+  int decoded_len = 0;
+#ifdef DECODE_CACHE
+  if (dcache_last != NULL) decoded_len = dcache_last->len;
+#endif
 #endif
 
-  if(cpu.INTR & cpu.eflags.IF){
-    cpu.INTR=false;
-    extern void raise_intr(uint8_t NO, vaddr_t ret_addr);
-    raise_intr(TIME_IRQ,cpu.eip);
-    update_eip();
+#ifdef CACHE_SIM
+  int fetch_len = (decoded_len != 0 ? decoded_len : decoding.seq_eip - cpu.eip);
+  cache_ifetch(fetch_addr, (fetch_len > 0 && fetch_len <= 15 ? fetch_len : 1));
+#endif
+
+#ifdef ITRACE
+  itrace_end(decoded_len);
+#endif
+#ifdef DEBUG
+  if (print_flag) {
+    int instr_len = decoding.seq_eip - cpu.eip;
+    sprintf(decoding.p, "%*.s", 50 - (12 + 3 * instr_len), "");
+    strcat(decoding.asm_buf, decoding.assembly);
+    puts(decoding.asm_buf);
   }
+#endif
+
+  update_eip();
+
+  check_intr();
 }
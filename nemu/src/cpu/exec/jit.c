@@ -0,0 +1,319 @@
+#include "cpu/block.h"
+#include "monitor/monitor.h"
+
+#ifdef JIT
+
+#include "all-instr.h"
+#include <sys/mman.h>
+#include <inttypes.h>
+
+/* The JIT translates a basic block to x86-64 host code. During the
+ * execution of the host code, rbx is pinned to `cpu', so guest registers
+ * are accessed as [rbx + offset].
+ *
+ * The most common 32-bit mov, lea and ALU instructions with register or
+ * immediate operands are translated to host instructions directly, and
+ * memory operands go through vaddr_read()/vaddr_write(). Like the
+ * execution helpers, they only record the flags lazily in cpu.cc. Each of the
+ * other instructions is translated to a call of jit_step(), which replays
+ * its decode cache entry with the execution helper written in RTL.
+ *
+ * The host code of a block returns the number of guest instructions
+ * executed. It returns early if the block is modified by itself.
+ */
+
+enum { H_EAX, H_ECX, H_EDX, H_EBX, H_ESP, H_EBP, H_ESI, H_EDI };
+
+static CPU_LOCAL uint8_t *code_cache = NULL;
+static CPU_LOCAL uint32_t code_used = 0;
+static CPU_LOCAL uint8_t *p;
+
+/* the block under execution */
+static CPU_LOCAL uint32_t cur_epoch, cur_ppn, cur_gen;
+
+static CPU_LOCAL uint64_t nr_translate, nr_native, nr_step;
+
+static inline void emit_b(uint8_t b) { *p ++ = b; }
+static inline void emit_l(uint32_t l) { memcpy(p, &l, 4); p += 4; }
+static inline void emit_q(uint64_t q) { memcpy(p, &q, 8); p += 8; }
+
+static inline uint32_t cpu_offset(void *field) {
+  return (uint8_t *)field - (uint8_t *)&cpu;
+}
+
+/* mov host, [rbx + off] */
+static inline void emit_load(int host, uint32_t off) {
+  emit_b(0x8b); emit_b(0x83 | (host << 3)); emit_l(off);
+}
+
+/* mov [rbx + off], host */
+static inline void emit_store(uint32_t off, int host) {
+  emit_b(0x89); emit_b(0x83 | (host << 3)); emit_l(off);
+}
+
+/* mov dword [rbx + off], imm */
+static inline void emit_store_imm(uint32_t off, uint32_t imm) {
+  emit_b(0xc7); emit_b(0x83); emit_l(off); emit_l(imm);
+}
+
+/* mov host, imm */
+static inline void emit_li(int host, uint32_t imm) {
+  emit_b(0xb8 + host); emit_l(imm);
+}
+
+static inline void emit_call(void *f) {
+  emit_b(0x48); emit_b(0xb8); emit_q((uintptr_t)f);   // mov rax, f
+  emit_b(0xff); emit_b(0xd0);                         // call rax
+}
+
+/* return `count' if al is not zero */
+static inline void emit_exit_if_al(uint32_t count) {
+  emit_b(0x84); emit_b(0xc0);   // test al, al
+  emit_b(0x74); emit_b(7);      // jz +7
+  emit_li(H_EAX, count);
+  emit_b(0x5b);                 // pop rbx
+  emit_b(0xc3);                 // ret
+}
+
+/* The same, but set eip to `eip' first, since the instructions
+ * translated to host instructions do not keep eip. */
+static inline void emit_exit_at_if_al(uint32_t count, vaddr_t eip) {
+  emit_b(0x84); emit_b(0xc0);   // test al, al
+  emit_b(0x74); emit_b(17);     // jz +17
+  emit_store_imm(cpu_offset(&cpu.eip), eip);
+  emit_li(H_EAX, count);
+  emit_b(0x5b);                 // pop rbx
+  emit_b(0xc3);                 // ret
+}
+
+/* eax <- effective address */
+static inline void emit_ea(const OperandRecipe *m) {
+  emit_li(H_EAX, m->val);
+  if (m->base_reg != -1) {
+    emit_b(0x03); emit_b(0x83); emit_l(cpu_offset(&reg_l(m->base_reg)));   // add eax, [rbx + base]
+  }
+  if (m->index_reg != -1) {
+    emit_load(H_ECX, cpu_offset(&reg_l(m->index_reg)));
+    if (m->scale != 0) {
+      emit_b(0xc1); emit_b(0xe1); emit_b(m->scale);   // shl ecx, scale
+    }
+    emit_b(0x01); emit_b(0xc8);   // add eax, ecx
+  }
+}
+
+/* record the operation in cpu.cc, see rtl_set_cc() */
+static inline void emit_set_cc(int op) {
+  emit_store_imm(cpu_offset(&cpu.cc.op), op);
+  emit_store_imm(cpu_offset(&cpu.cc.width), 4);
+}
+
+/* call rtl_cc_materialize() if some flags are pending */
+static inline void emit_cc_sync() {
+  emit_b(0x83); emit_b(0xbb); emit_l(cpu_offset(&cpu.cc.op)); emit_b(CC_OP_NONE);  // cmp dword [rbx + off], 0
+  emit_b(0x74); emit_b(12);   // jz +12
+  emit_call(rtl_cc_materialize);
+}
+
+/* Replay an instruction with its execution helper. Return true if the
+ * block under execution becomes stale, or NEMU is stopped, e.g. by a
+ * memory watchpoint.
+ */
+static bool jit_step(const DecodeCacheEntry *e) {
+  cpu.eip = e->eip;
+  decoding.seq_eip = e->eip;
+  decode_cache_replay(e, &decoding.seq_eip);
+  cpu.eip = (decoding.is_jmp ? (decoding.is_jmp = 0, decoding.jmp_eip) : decoding.seq_eip);
+  return !decode_cache_is_valid(cur_epoch, cur_ppn, cur_gen) || nemu_state != NEMU_RUNNING;
+}
+
+static bool jit_store(vaddr_t addr, uint32_t data) {
+  vaddr_write(addr, 4, data);
+  return !decode_cache_is_valid(cur_epoch, cur_ppn, cur_gen) || nemu_state != NEMU_RUNNING;
+}
+
+static inline bool is_reg32(const OperandRecipe *op) {
+  return op->type == OP_TYPE_REG && op->width == 4;
+}
+
+static inline bool is_loaded_reg32(const OperandRecipe *op) {
+  return is_reg32(op) && op->load == OP_LOAD_REG && op->load_width == 4;
+}
+
+static const struct {
+  EHelper execute;
+  uint8_t op_rr, op_ri;   // op eax, ecx; op eax, imm32
+  bool write_back;
+  int cc_op;
+} alu_table[] = {
+  { exec_add_l,  0x01, 0x05, true,  CC_OP_ADD },
+  { exec_or_l,   0x09, 0x0d, true,  CC_OP_LOGIC },
+  { exec_and_l,  0x21, 0x25, true,  CC_OP_LOGIC },
+  { exec_sub_l,  0x29, 0x2d, true,  CC_OP_SUB },
+  { exec_xor_l,  0x31, 0x35, true,  CC_OP_LOGIC },
+  { exec_cmp_l,  0x29, 0x2d, false, CC_OP_SUB },
+  { exec_test_l, 0x21, 0x25, false, CC_OP_LOGIC },
+};
+
+#define NR_ALU (sizeof(alu_table) / sizeof(alu_table[0]))
+
+/* Translate an instruction to host instructions. Return false if it is
+ * not supported.
+ */
+static bool translate_native(const DecodeCacheEntry *e, uint32_t count) {
+  const OperandRecipe *dest = &e->dest, *src = &e->src;
+  if (e->is_operand_size_16) return false;
+
+  int i;
+  for (i = 0; i < NR_ALU; i ++) {
+    if (e->execute == alu_table[i].execute) {
+      if (!is_loaded_reg32(dest)) return false;
+      uint32_t off = cpu_offset(&reg_l(dest->val));
+      bool save_operands = (alu_table[i].cc_op != CC_OP_LOGIC);
+      if (is_loaded_reg32(src)) {
+        emit_load(H_EAX, off);
+        emit_load(H_ECX, cpu_offset(&reg_l(src->val)));
+        if (save_operands) {
+          emit_store(cpu_offset(&cpu.cc.dest), H_EAX);
+          emit_store(cpu_offset(&cpu.cc.src), H_ECX);
+        }
+        emit_b(alu_table[i].op_rr); emit_b(0xc8);
+      }
+      else if (src->type == OP_TYPE_IMM) {
+        emit_load(H_EAX, off);
+        if (save_operands) {
+          emit_store(cpu_offset(&cpu.cc.dest), H_EAX);
+          emit_store_imm(cpu_offset(&cpu.cc.src), src->val);
+        }
+        emit_b(alu_table[i].op_ri); emit_l(src->val);
+      }
+      else return false;
+      emit_store(cpu_offset(&cpu.cc.res), H_EAX);
+      emit_set_cc(alu_table[i].cc_op);
+      if (alu_table[i].write_back) {
+        emit_store(off, H_EAX);
+      }
+      return true;
+    }
+  }
+
+  if (e->execute == exec_inc_l || e->execute == exec_dec_l) {
+    if (!is_loaded_reg32(dest)) return false;
+    uint32_t off = cpu_offset(&reg_l(dest->val));
+    /* CF is kept */
+    emit_cc_sync();
+    emit_load(H_EAX, off);
+    emit_b(0xff); emit_b(e->execute == exec_inc_l ? 0xc0 : 0xc8);   // inc/dec eax
+    emit_store(cpu_offset(&cpu.cc.res), H_EAX);
+    emit_set_cc(e->execute == exec_inc_l ? CC_OP_INC : CC_OP_DEC);
+    emit_store(off, H_EAX);
+    return true;
+  }
+
+  if (e->execute == exec_lea) {
+    if (!is_reg32(dest) || src->type != OP_TYPE_MEM) return false;
+    emit_ea(src);
+    emit_store(cpu_offset(&reg_l(dest->val)), H_EAX);
+    return true;
+  }
+
+  if (e->execute == exec_mov_l) {
+    if (is_reg32(dest)) {
+      uint32_t off = cpu_offset(&reg_l(dest->val));
+      if (src->type == OP_TYPE_IMM) {
+        emit_store_imm(off, src->val);
+      }
+      else if (is_loaded_reg32(src)) {
+        emit_load(H_EAX, cpu_offset(&reg_l(src->val)));
+        emit_store(off, H_EAX);
+      }
+      else if (src->type == OP_TYPE_MEM && src->load == OP_LOAD_MEM && src->load_width == 4) {
+        emit_ea(src);
+        emit_b(0x89); emit_b(0xc7);   // mov edi, eax
+        emit_li(H_ESI, 4);
+        emit_call(vaddr_read);
+        emit_store(off, H_EAX);
+      }
+      else return false;
+      return true;
+    }
+    if (dest->type == OP_TYPE_MEM && dest->width == 4) {
+      if (src->type == OP_TYPE_IMM) {
+        emit_ea(dest);
+        emit_li(H_ESI, src->val);
+      }
+      else if (is_loaded_reg32(src)) {
+        emit_ea(dest);
+        emit_load(H_ESI, cpu_offset(&reg_l(src->val)));
+      }
+      else return false;
+      emit_b(0x89); emit_b(0xc7);   // mov edi, eax
+      emit_call(jit_store);
+      /* the block is modified by the store, or NEMU is stopped, go on after it */
+      emit_exit_at_if_al(count, e->eip + e->len);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void jit_flush() {
+  code_used = 0;
+}
+
+/* Translate `len' instructions of a block to host code. */
+void* jit_translate(const DecodeCacheEntry *instr, int len) {
+  if (code_cache == NULL) {
+    code_cache = mmap(NULL, JIT_CACHE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    Assert(code_cache != MAP_FAILED, "Can not allocate the JIT code cache");
+  }
+  assert(code_used + len * JIT_INSTR_SIZE <= JIT_CACHE_SIZE);
+
+  void *code = p = code_cache + code_used;
+  emit_b(0x53);                               // push rbx
+  emit_b(0x48); emit_b(0x89); emit_b(0xfb);   // mov rbx, rdi
+
+  int i;
+  bool native = false;
+  for (i = 0; i < len; i ++) {
+    const DecodeCacheEntry *e = &instr[i];
+    native = translate_native(e, i + 1);
+    if (native) {
+      nr_native ++;
+    }
+    else {
+      emit_b(0x48); emit_b(0xbf); emit_q((uintptr_t)e);   // mov rdi, e
+      emit_call(jit_step);
+      emit_exit_if_al(i + 1);
+      nr_step ++;
+    }
+  }
+
+  if (native) {
+    /* jit_step() does not run for the last instruction */
+    const DecodeCacheEntry *e = &instr[len - 1];
+    emit_store_imm(cpu_offset(&cpu.eip), e->eip + e->len);
+  }
+  emit_li(H_EAX, len);
+  emit_b(0x5b);   // pop rbx
+  emit_b(0xc3);   // ret
+
+  code_used = p - code_cache;
+  nr_translate ++;
+  return code;
+}
+
+uint32_t jit_exec(void *code, uint32_t epoch, uint32_t ppn, uint32_t gen) {
+  cur_epoch = epoch;
+  cur_ppn = ppn;
+  cur_gen = gen;
+  return ((uint32_t (*)(CPU_state *))code)(&cpu);
+}
+
+void jit_stat() {
+  printf("jit: %" PRIu64 " blocks translated, %" PRIu64 " native instructions, %" PRIu64 " helper calls, %u bytes of code\n",
+      nr_translate, nr_native, nr_step, code_used);
+}
+
+#endif
@@ -1,85 +1,74 @@
 #include "cpu/exec.h"
 
-make_EHelper(test) {
+make_EHelper_W(test) {
   //TODO();
   rtl_and(&t2,&id_dest->val,&id_src->val);
-  rtl_update_ZFSF(&t2,id_dest->width);
-  rtl_set_CF(&tzero);
-  rtl_set_OF(&tzero);
+  rtl_set_cc(CC_OP_LOGIC,&tzero,&tzero,&t2,width);
 
   print_asm_template2(test);
 }
 
-make_EHelper(and) {
+make_EHelper_W(and) {
   // TODO();
   rtl_and(&t2,&id_dest->val,&id_src->val);
-  operand_write(id_dest,&t2);
+  operand_write_w(id_dest,&t2,width);
 
-  rtl_update_ZFSF(&t2,id_dest->width);
-  rtl_set_CF(&tzero);
-  rtl_set_OF(&tzero);
+  rtl_set_cc(CC_OP_LOGIC,&tzero,&tzero,&t2,width);
 
   print_asm_template2(and);
 }
 
-make_EHelper(xor) {
+make_EHelper_W(xor) {
   // TODO();
   rtl_xor(&t2,&id_dest->val,&id_src->val);
-  operand_write(id_dest,&t2);
+  operand_write_w(id_dest,&t2,width);
 
   //修改eflags
-  //SF ZF
-  rtl_update_ZFSF(&t2,id_dest->width);
-  //CF OF <- 0
-  rtl_set_CF(&tzero);
-  rtl_set_OF(&tzero);
+  rtl_set_cc(CC_OP_LOGIC,&tzero,&tzero,&t2,width);
 
   print_asm_template2(xor);
 }
 
-make_EHelper(or) {
+make_EHelper_W(or) {
   //TODO();
   rtl_or(&t2,&id_dest->val,&id_src->val);
-  operand_write(id_dest,&t2);
+  operand_write_w(id_dest,&t2,width);
 
-  rtl_update_ZFSF(&t2,id_dest->width);
-
-  rtl_set_CF(&tzero);
-  rtl_set_OF(&tzero);
+  rtl_set_cc(CC_OP_LOGIC,&tzero,&tzero,&t2,width);
 
   print_asm_template2(or);
 }
 
-make_EHelper(sar) {
+make_EHelper_W(sar) {
   //TODO();
   // unnecessary to update CF and OF in NEMU
-  rtl_sext(&t2,&id_dest->val,id_dest->width);//符号扩展
+  rtl_sext(&t2,&id_dest->val,width);//符号扩展
   rtl_sar(&t2,&t2,&id_src->val);
-  operand_write(id_dest,&t2);
+  operand_write_w(id_dest,&t2,width);
 
-  rtl_update_ZFSF(&t2,id_dest->width);
+  rtl_set_cc(CC_OP_ZFSF,&tzero,&tzero,&t2,width);
 
   print_asm_template2(sar);
 }
 
-make_EHelper(shl) {
+make_EHelper_W(shl) {
   //TODO();
   // unnecessary to update CF and OF in NEMU
   rtl_shl(&t2,&id_dest->val,&id_src->val);
-  operand_write(id_dest,&t2);
+  operand_write_w(id_dest,&t2,width);
 
-  rtl_update_ZFSF(&t2,id_dest->width);
+  rtl_set_cc(CC_OP_ZFSF,&tzero,&tzero,&t2,width);
 
   print_asm_template2(shl);
 }
 
-make_EHelper(shr) {
+make_EHelper_W(shr) {
   //TODO();
   // unnecessary to update CF and OF in NEMU
   rtl_shr(&t2,&id_dest->val,&id_src->val);
-  operand_write(id_dest,&t2);
+  operand_write_w(id_dest,&t2,width);
 
-  rtl_update_ZFSF(&t2,id_dest->width);
+  rtl_set_cc(CC_OP_ZFSF,&tzero,&tzero,&t2,width);
 
   print_asm_template2(shr);
 }
@@ -0,0 +1,154 @@
+#include "cpu/decode-cache.h"
+
+#ifdef OPCODE_STAT
+
+#include <inttypes.h>
+#include <stdlib.h>
+
+/* one-byte opcodes, then two-byte opcodes 0f xx at 0x100 + xx */
+#define NR_OPCODE 0x200
+
+enum {
+  FORM_NONE, FORM_DISP, FORM_BASE, FORM_BASE_DISP,
+  FORM_BASE_INDEX, FORM_BASE_INDEX_DISP, FORM_INDEX_DISP, NR_FORM
+};
+
+static const char *form_name[] = {
+  "no memory operand", "[disp]", "[base]", "[base+disp]",
+  "[base+index*s]", "[base+index*s+disp]", "[index*s+disp]",
+};
+
+/* shared by all CPUs, so counts of several CPUs may race */
+static uint64_t count[NR_OPCODE][NR_FORM];
+static uint64_t nr_timed[NR_OPCODE], decode_cycles[NR_OPCODE], exec_cycles[NR_OPCODE];
+
+CPU_LOCAL bool opstat_timed;
+CPU_LOCAL uint64_t opstat_decode_cycles;
+/* the instructions left until the next one timed */
+static CPU_LOCAL uint32_t countdown = OPSTAT_TIME_EVERY;
+static CPU_LOCAL uint32_t seed = 1;
+static CPU_LOCAL uint64_t start;
+
+static inline int form(uint32_t type, int base, int index, int32_t disp) {
+  if (type != OP_TYPE_MEM) return FORM_NONE;
+  if (base == -1) return (index == -1 ? FORM_DISP : FORM_INDEX_DISP);
+  if (index == -1) return (disp == 0 ? FORM_BASE : FORM_BASE_DISP);
+  return (disp == 0 ? FORM_BASE_INDEX : FORM_BASE_INDEX_DISP);
+}
+
+static inline int recipe_form(const OperandRecipe *r) {
+  return form(r->type, r->base_reg, r->index_reg, r->val);
+}
+
+static inline int operand_form(const Operand *op) {
+  return form(op->type, op->base_reg, op->index_reg, op->disp);
+}
+
+void opstat_begin() {
+  opstat_timed = (-- countdown == 0);
+  if (opstat_timed) {
+    /* a xorshift, the gaps are uniform in [1, 2 * OPSTAT_TIME_EVERY - 1] */
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    countdown = 1 + seed % (2 * OPSTAT_TIME_EVERY - 1);
+    opstat_decode_cycles = 0;
+    start = opstat_now();
+  }
+  /* the operands which are not decoded have no memory form */
+  decoding.src.type = decoding.dest.type = decoding.src2.type = OP_TYPE_IMM;
+}
+
+void opstat_end(const DecodeCacheEntry *e) {
+  uint64_t end = (opstat_timed ? opstat_now() : 0);
+  uint32_t opcode = decoding.opcode & (NR_OPCODE - 1);
+
+  int f;
+  if (e != NULL) {
+    f = recipe_form(&e->dest);
+    if (f == FORM_NONE) f = recipe_form(&e->src);
+    if (f == FORM_NONE) f = recipe_form(&e->src2);
+  }
+  else {
+    f = operand_form(id_dest);
+    if (f == FORM_NONE) f = operand_form(id_src);
+    if (f == FORM_NONE) f = operand_form(id_src2);
+  }
+  count[opcode][f] ++;
+
+  if (opstat_timed) {
+    uint64_t total = end - start;
+    uint64_t decode = (opstat_decode_cycles < total ? opstat_decode_cycles : total);
+    nr_timed[opcode] ++;
+    decode_cycles[opcode] += decode;
+    exec_cycles[opcode] += total - decode;
+    opstat_timed = false;
+  }
+}
+
+static uint64_t opcode_total(int opcode) {
+  uint64_t n = 0;
+  int f;
+  for (f = 0; f < NR_FORM; f ++) {
+    n += count[opcode][f];
+  }
+  return n;
+}
+
+static int opcode_cmp(const void *a, const void *b) {
+  uint64_t x = opcode_total(*(const int *)a), y = opcode_total(*(const int *)b);
+  return (x < y) - (x > y);
+}
+
+/* Print the `top' opcodes executed most, and the addressing forms. */
+void opstat_report(int top) {
+  int order[NR_OPCODE];
+  uint64_t total = 0, form_total[NR_FORM] = {0};
+  int i, f;
+  for (i = 0; i < NR_OPCODE; i ++) {
+    order[i] = i;
+    for (f = 0; f < NR_FORM; f ++) {
+      form_total[f] += count[i][f];
+    }
+    total += opcode_total(i);
+  }
+  if (total == 0) {
+    printf("No instructions counted yet\n");
+    return;
+  }
+  qsort(order, NR_OPCODE, sizeof(order[0]), opcode_cmp);
+
+  printf("%" PRIu64 " instructions, about one in %d timed for host cycles per instruction\n",
+      total, OPSTAT_TIME_EVERY);
+  printf("opcode            count       %%    cum%%    mem%%    decode   execute\n");
+  uint64_t cum = 0;
+  for (i = 0; i < top && i < NR_OPCODE; i ++) {
+    int op = order[i];
+    uint64_t n = opcode_total(op);
+    if (n == 0) break;
+    cum += n;
+    char name[8];
+    if (op < 0x100) sprintf(name, "   %02x", op);
+    else sprintf(name, "0f %02x", op & 0xff);
+    uint64_t t = nr_timed[op];
+    printf("%s  %15" PRIu64 "  %6.2f  %6.2f  %6.2f  %8.1f  %8.1f\n", name, n,
+        100.0 * n / total, 100.0 * cum / total, 100.0 * (n - count[op][FORM_NONE]) / n,
+        t == 0 ? 0.0 : (double)decode_cycles[op] / t, t == 0 ? 0.0 : (double)exec_cycles[op] / t);
+  }
+
+  printf("addressing form               count       %%\n");
+  for (f = 0; f < NR_FORM; f ++) {
+    printf("%-22s  %13" PRIu64 "  %6.2f\n", form_name[f], form_total[f], 100.0 * form_total[f] / total);
+  }
+}
+
+static void opstat_exit() {
+  opstat_report(30);
+}
+
+/* Report at exit. */
+void init_opstat() {
+  atexit(opstat_exit);
+}
+
+#endif
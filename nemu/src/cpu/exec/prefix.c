@@ -1,4 +1,6 @@
 #include "cpu/exec.h"
+#include "cpu/decode-cache.h"
+#include "cpu/mp.h"
 
 make_EHelper(real);
 
@@ -7,3 +9,17 @@ make_EHelper(operand_size) {
   exec_real(eip);
   decoding.is_operand_size_16 = false;
 }
+
+/* The instruction runs with the bus locked, so it is atomic against the
+ * locked instructions, xchg and cmpxchg of the other CPUs, but not
+ * against their plain writes.
+ */
+make_EHelper(lock) {
+  mp_lock_bus();
+  exec_real(eip);
+  mp_unlock_bus();
+#ifdef DECODE_CACHE
+  /* a cached instruction would be replayed without the prefix */
+  decode_cache_skip();
+#endif
+}
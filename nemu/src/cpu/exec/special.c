@@ -1,5 +1,6 @@
 #include "cpu/exec.h"
 #include "monitor/monitor.h"
+#include "monitor/diff-test.h"
 
 make_EHelper(nop) {
   print_asm("nop");
@@ -7,6 +8,10 @@ make_EHelper(nop) {
 
 make_EHelper(inv) {
   /* invalid opcode */
+#ifdef DIFF_TEST
+  /* NEMU has not stopped here, the reference has gone astray */
+  if (difftest_is_ref) return;
+#endif
 
   uint32_t temp[2];
   vaddr_t ori_eip = cpu.eip;
@@ -30,17 +35,24 @@ make_EHelper(inv) {
   nemu_state = NEMU_END;
 
   print_asm("invalid opcode");
+
+#ifdef DIFF_TEST
+  difftest_skip_ref();
+#endif
 }
 
 make_EHelper(nemu_trap) {
+#ifdef DIFF_TEST
+  if (difftest_is_ref) return;
+#endif
   print_asm("nemu trap (eax = %d)", cpu.eax);
 
   printf("\33[1;31mnemu: HIT %s TRAP\33[0m at eip = 0x%08x\n\n",
       (cpu.eax == 0 ? "GOOD" : "BAD"), cpu.eip);
   nemu_state = NEMU_END;
+  nemu_trap_state = (cpu.eax == 0 ? TRAP_GOOD : TRAP_BAD);
 
 #ifdef DIFF_TEST
-  extern void diff_test_skip_qemu();
-  diff_test_skip_qemu();
+  difftest_skip_ref();
 #endif
 }
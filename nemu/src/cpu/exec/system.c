@@ -1,7 +1,6 @@
 #include "cpu/exec.h"
-
-void diff_test_skip_qemu();
-void diff_test_skip_nemu();
+#include "monitor/diff-test.h"
+#include "monitor/ftrace.h"
 
 make_EHelper(lidt) {
   //TODO();
@@ -21,6 +20,14 @@ make_EHelper(lidt) {
   print_asm_template1(lidt);
 }
 
+make_EHelper(invlpg) {
+  tlb_flush_page(id_dest->addr);
+  /* eip may be mapped to a different instruction now */
+  decode_cache_flush();
+
+  print_asm_template1(invlpg);
+}
+
 make_EHelper(mov_r2cr) {
   TODO();
 
@@ -33,7 +40,7 @@ make_EHelper(mov_cr2r) {
   print_asm("movl %%cr%d,%%%s", id_src->reg, reg_name(id_dest->reg, 4));
 
 #ifdef DIFF_TEST
-  diff_test_skip_qemu();
+  difftest_skip_ref();
 #endif
 }
 
@@ -47,7 +54,7 @@ make_EHelper(int) {
   print_asm("int %s", id_dest->str);
 
 #ifdef DIFF_TEST
-  diff_test_skip_nemu();
+  difftest_skip_dut();
 #endif
 }
 
@@ -56,10 +63,12 @@ make_EHelper(iret) {
   rtl_pop(&cpu.eip);
   rtl_pop(&cpu.cs);
   rtl_pop(&t0);
+  cpu.cc.op=CC_OP_NONE;//drop the pending flags, they are overwritten
   memcpy(&cpu.eflags,&t0,sizeof(cpu.eflags));//why use t0?
 
   //decoding.jmp_eip=1;//what is this for?
   decoding.seq_eip=cpu.eip;
+  ftrace_hook(FTRACE_IRET, cpu.eip, 0, cpu.esp - 12);
 
   print_asm("iret");
 }
@@ -73,10 +82,6 @@ make_EHelper(in) {
   operand_write(id_dest,&t0);
 
   print_asm_template2(in);
-
-#ifdef DIFF_TEST
-  diff_test_skip_qemu();
-#endif
 }
 
 make_EHelper(out) {
@@ -84,8 +89,4 @@ make_EHelper(out) {
   pio_write(id_dest->val,id_src->width,id_src->val);
 
   print_asm_template2(out);
-
-#ifdef DIFF_TEST
-  diff_test_skip_qemu();
-#endif
 }
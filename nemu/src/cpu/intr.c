@@ -1,5 +1,6 @@
 #include "cpu/exec.h"
 #include "memory/mmu.h"
+#include "monitor/ftrace.h"
 
 void raise_intr(uint8_t NO, vaddr_t ret_addr) {
   /* TODO: Trigger an interrupt/exception with ``NO''.
@@ -8,6 +9,7 @@ void raise_intr(uint8_t NO, vaddr_t ret_addr) {
 
   //TODO();
   //eflags,cs,eip入栈
+  rtl_cc_sync();
   memcpy(&t1,&cpu.eflags,sizeof(cpu.eflags));
   rtl_li(&t0,t1);//???
   rtl_push(&t0);
@@ -32,6 +34,7 @@ void raise_intr(uint8_t NO, vaddr_t ret_addr) {
   //设置decoding
   decoding.is_jmp=1;
   decoding.jmp_eip=target_addr;
+  ftrace_hook(FTRACE_INTR, ret_addr, target_addr, cpu.esp);
 }
 
 void dev_raise_intr() {
@@ -0,0 +1,158 @@
+#include "nemu.h"
+#include "cpu/mp.h"
+#include "cpu/block.h"
+#include "monitor/monitor.h"
+#include "device/event.h"
+#include <pthread.h>
+
+/* each thread needs room for the CPU_LOCAL state besides its stack */
+#define AP_STACK_SIZE (64 * 1024 * 1024)
+
+int nr_cpu = 1;
+CPU_LOCAL int cpu_id = 0;
+
+static pthread_mutex_t bus_lock = PTHREAD_MUTEX_INITIALIZER;
+/* how many times this CPU holds the bus lock, e.g. twice for lock xchg */
+static CPU_LOCAL int bus_lock_depth = 0;
+static pthread_mutex_t io_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* protects the states below */
+static pthread_mutex_t mp_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t mp_cond = PTHREAD_COND_INITIALIZER;
+
+/* the application processors (APs) may run */
+static volatile bool mp_running = false;
+/* the number of APs out of the waiting loop */
+static int nr_active = 0;
+/* the APs are started by the guest with the state in `boot_cpu' */
+static bool ap_started = false;
+static CPU_state boot_cpu;
+static uint8_t *boot_pmem;
+
+static CPU_LOCAL volatile bool halted = false;
+
+void exec_wrapper(bool);
+void timer_intr(void);
+
+static void* ap_main(void *arg) {
+  cpu_id = (intptr_t)arg;
+  pmem = boot_pmem;
+  bool booted = false;
+  uint64_t timer_left = INSTR_PER_SEC / TIMER_HZ;
+
+  pthread_mutex_lock(&mp_lock);
+  while (true) {
+    while (!mp_running || nemu_state != NEMU_RUNNING || !ap_started || halted) {
+      pthread_cond_wait(&mp_cond, &mp_lock);
+    }
+    if (!booted) {
+      cpu = boot_cpu;
+      booted = true;
+    }
+    nr_active ++;
+    pthread_mutex_unlock(&mp_lock);
+
+    while (mp_running && nemu_state == NEMU_RUNNING && !halted) {
+      host_tlb_sync();
+#ifdef BLOCK_ENGINE
+      uint32_t count = exec_block(timer_left);
+#else
+      exec_wrapper(false);
+      uint32_t count = 1;
+#endif
+      /* each CPU has its own timer */
+      timer_left -= count;
+      if (timer_left == 0) {
+        timer_intr();
+        timer_left = INSTR_PER_SEC / TIMER_HZ;
+      }
+    }
+
+    pthread_mutex_lock(&mp_lock);
+    nr_active --;
+    pthread_cond_broadcast(&mp_cond);
+  }
+  return NULL;
+}
+
+void init_mp(int n) {
+  Assert(n >= 1 && n <= MAX_CPU, "The number of CPUs should be 1 to %d", MAX_CPU);
+  nr_cpu = n;
+  boot_pmem = pmem;
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, AP_STACK_SIZE);
+  int i;
+  for (i = 1; i < nr_cpu; i ++) {
+    pthread_t thread;
+    int ret = pthread_create(&thread, &attr, ap_main, (void *)(intptr_t)i);
+    Assert(ret == 0, "Can not create the thread of CPU %d", i);
+  }
+  pthread_attr_destroy(&attr);
+}
+
+/* Called by cpu_exec() when CPU 0 starts running. */
+void mp_resume() {
+  if (nr_cpu == 1) return;
+  pthread_mutex_lock(&mp_lock);
+  mp_running = true;
+  pthread_cond_broadcast(&mp_cond);
+  pthread_mutex_unlock(&mp_lock);
+}
+
+/* Called by cpu_exec() when CPU 0 stops. Return after all APs stop. */
+void mp_pause() {
+  if (nr_cpu == 1) return;
+  pthread_mutex_lock(&mp_lock);
+  mp_running = false;
+  while (nr_active > 0) {
+    pthread_cond_wait(&mp_cond, &mp_lock);
+  }
+  pthread_mutex_unlock(&mp_lock);
+}
+
+/* Start all APs at `eip'. They share the control registers of the
+ * current CPU, with interrupts disabled.
+ */
+void mp_start(vaddr_t eip) {
+  pthread_mutex_lock(&mp_lock);
+  if (ap_started) {
+    Log("The APs are started already");
+  }
+  else {
+    rtl_cc_sync();
+    boot_cpu = cpu;
+    boot_cpu.eip = eip;
+    boot_cpu.eflags.IF = 0;
+    boot_cpu.INTR = false;
+    ap_started = true;
+    pthread_cond_broadcast(&mp_cond);
+  }
+  pthread_mutex_unlock(&mp_lock);
+}
+
+/* Stop the current CPU for good. */
+void mp_halt() {
+  if (cpu_id == 0) {
+    Log("CPU 0 can not be stopped");
+    return;
+  }
+  halted = true;
+}
+
+void mp_lock_bus() {
+  if (nr_cpu > 1 && bus_lock_depth ++ == 0) pthread_mutex_lock(&bus_lock);
+}
+
+void mp_unlock_bus() {
+  if (nr_cpu > 1 && -- bus_lock_depth == 0) pthread_mutex_unlock(&bus_lock);
+}
+
+void mp_lock_io() {
+  if (nr_cpu > 1) pthread_mutex_lock(&io_lock);
+}
+
+void mp_unlock_io() {
+  if (nr_cpu > 1) pthread_mutex_unlock(&io_lock);
+}
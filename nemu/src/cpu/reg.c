@@ -2,7 +2,7 @@
 #include <stdlib.h>
 #include <time.h>
 
-CPU_state cpu;
+CPU_LOCAL CPU_state cpu;
 
 const char *regsl[] = {"eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi"};
 const char *regsw[] = {"ax", "cx", "dx", "bx", "sp", "bp", "si", "di"};
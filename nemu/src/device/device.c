@@ -2,51 +2,34 @@
 
 #ifdef HAS_IOE
 
-#include <sys/time.h>
-#include <signal.h>
+#include "device/event.h"
 #include <SDL2/SDL.h>
 
-#define TIMER_HZ 100
 #define VGA_HZ 50
 
-static uint64_t jiffy = 0;
-static struct itimerval it;
-static int device_update_flag = false;
-static int update_screen_flag = false;
+static int timer_event, vga_event;
 
 void init_serial();
 void init_timer();
 void init_vga();
 void init_i8042();
+void init_mpe();
 
 extern void timer_intr();
 extern void send_key(uint8_t, bool);
+extern void replay_send_key();
 extern void update_screen();
 
 
-static void timer_sig_handler(int signum) {
-  jiffy ++;
-  timer_intr();
-
-  device_update_flag = true;
-  if (jiffy % (TIMER_HZ / VGA_HZ) == 0) {
-    update_screen_flag = true;
-  }
-
-  int ret = setitimer(ITIMER_VIRTUAL, &it, NULL);
-  Assert(ret == 0, "Can not set timer");
+static void vga_event_handler() {
+  update_screen();
+  event_schedule(vga_event, INSTR_PER_SEC / VGA_HZ);
 }
 
-void device_update() {
-  if (!device_update_flag) {
-    return;
-  }
-  device_update_flag = false;
-
-  if (update_screen_flag) {
-    update_screen();
-    update_screen_flag = false;
-  }
+/* The timer also polls the input events of the host. */
+static void timer_event_handler() {
+  timer_intr();
+  event_schedule(timer_event, INSTR_PER_SEC / TIMER_HZ);
 
   SDL_Event event;
   while (SDL_PollEvent(&event)) {
@@ -66,6 +49,8 @@ void device_update() {
       default: break;
     }
   }
+
+  replay_send_key();
 }
 
 void sdl_clear_event_queue() {
@@ -78,17 +63,12 @@ void init_device() {
   init_timer();
   init_vga();
   init_i8042();
+  init_mpe();
 
-  struct sigaction s;
-  memset(&s, 0, sizeof(s));
-  s.sa_handler = timer_sig_handler;
-  int ret = sigaction(SIGVTALRM, &s, NULL);
-  Assert(ret == 0, "Can not set signal handler");
-
-  it.it_value.tv_sec = 0;
-  it.it_value.tv_usec = 1000000 / TIMER_HZ;
-  ret = setitimer(ITIMER_VIRTUAL, &it, NULL);
-  Assert(ret == 0, "Can not set timer");
+  timer_event = add_event("timer", timer_event_handler);
+  vga_event = add_event("vga", vga_event_handler);
+  event_schedule(timer_event, INSTR_PER_SEC / TIMER_HZ);
+  event_schedule(vga_event, INSTR_PER_SEC / VGA_HZ);
 }
 #else
 
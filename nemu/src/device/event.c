@@ -0,0 +1,65 @@
+#include "device/event.h"
+#include "monitor/snapshot.h"
+#include "cpu/mp.h"
+
+#define NR_EVENT 16
+#define NEVER UINT64_MAX
+
+typedef struct {
+  const char *name;
+  event_handler_t handler;
+  uint64_t when;
+} Event;
+
+static Event events[NR_EVENT];
+static int nr_event = 0;
+
+uint64_t nr_guest_instr = 0;
+uint64_t next_event = NEVER;
+
+void update_next_event() {
+  int i;
+  next_event = NEVER;
+  for (i = 0; i < nr_event; i ++) {
+    if (events[i].when < next_event) {
+      next_event = events[i].when;
+    }
+  }
+}
+
+/* Register an event, which is not scheduled yet. Return its ID. */
+int add_event(const char *name, event_handler_t handler) {
+  assert(nr_event < NR_EVENT);
+  events[nr_event].name = name;
+  events[nr_event].handler = handler;
+  events[nr_event].when = NEVER;
+  snapshot_add(&events[nr_event].when, sizeof(events[nr_event].when), "event:%s", name);
+  return nr_event ++;
+}
+
+/* Run the handler of event `id' after `delay' instructions. */
+void event_schedule(int id, uint64_t delay) {
+  assert(id >= 0 && id < nr_event && delay > 0);
+  events[id].when = nr_guest_instr + delay;
+  if (events[id].when < next_event) {
+    next_event = events[id].when;
+  }
+}
+
+/* Run the handlers of all due events. A handler usually schedules its
+ * event again. Events are run by CPU 0, and the clock is the number of
+ * instructions it executes.
+ */
+void event_run() {
+  int i;
+  /* handlers access devices */
+  mp_lock_io();
+  for (i = 0; i < nr_event; i ++) {
+    if (events[i].when <= nr_guest_instr) {
+      events[i].when = NEVER;
+      events[i].handler();
+    }
+  }
+  mp_unlock_io();
+  update_next_event();
+}
@@ -1,8 +1,11 @@
 #include "common.h"
 #include "device/mmio.h"
+#include "monitor/snapshot.h"
+#include "cpu/mp.h"
+#include "monitor/diff-test.h"
 
-#define MMIO_SPACE_MAX (512 * 1024)
-#define NR_MAP 8
+#define MMIO_SPACE_MAX (2 * 1024 * 1024)
+#define NR_MAP 254
 
 static uint8_t mmio_space_pool[MMIO_SPACE_MAX];
 static uint32_t mmio_space_free_index = 0;
@@ -17,6 +20,14 @@ typedef struct {
 static MMIO_t maps[NR_MAP];
 static int nr_map = 0;
 
+/* The device mapped in each physical page: 0 for none, `map_NO + 1' for
+ * a single device, or MMIO_SHARED if several devices share the page.
+ */
+#define NR_PAGE (1 << 20)
+#define MMIO_SHARED 0xff
+
+static uint8_t page_map[NR_PAGE];
+
 /* device interface */
 void* add_mmio_map(paddr_t addr, int len, mmio_callback_t callback) {
   assert(nr_map < NR_MAP);
@@ -27,13 +38,29 @@ void* add_mmio_map(paddr_t addr, int len, mmio_callback_t callback) {
   maps[nr_map].high = addr + len - 1;
   maps[nr_map].mmio_space = space_base;
   maps[nr_map].callback = callback;
+
+  uint32_t ppn;
+  for (ppn = addr >> 12; ppn <= maps[nr_map].high >> 12; ppn ++) {
+    page_map[ppn] = (page_map[ppn] == 0 ? nr_map + 1 : MMIO_SHARED);
+  }
   nr_map ++;
   mmio_space_free_index += len;
+  snapshot_add(space_base, len, "mmio@0x%x", addr);
   return space_base;
 }
 
 /* bus interface */
 int is_mmio(paddr_t addr) {
+  int idx = page_map[addr >> 12];
+  if (idx == 0) {
+    return -1;
+  }
+  if (idx != MMIO_SHARED) {
+    /* the device may cover only part of the page */
+    MMIO_t *map = &maps[idx - 1];
+    return (addr >= map->low && addr <= map->high ? idx - 1 : -1);
+  }
+
   int i;
   for (i = 0; i < nr_map; i ++) {
     if (addr >= maps[i].low && addr <= maps[i].high) {
@@ -43,12 +70,27 @@ int is_mmio(paddr_t addr) {
   return -1;
 }
 
+/* Return true if some device is mapped in the page at `addr'. */
+bool is_mmio_page(paddr_t addr) {
+  return page_map[addr >> 12] != 0;
+}
+
 uint32_t mmio_read(paddr_t addr, int len, int map_NO) {
   assert(len >= 1 && len <= 4);
+#ifdef DIFF_TEST
+  /* the reference, and NEMU re-running from a checkpoint, get what NEMU has read */
+  uint32_t replayed;
+  if (difftest_replay_read(&replayed)) return replayed;
+#endif
   MMIO_t *map = &maps[map_NO];
+  mp_lock_io();
   uint32_t data = *(uint32_t *)(map->mmio_space + (addr - map->low)) 
     & (~0u >> ((4 - len) << 3));
   map->callback(addr, len, false);
+  mp_unlock_io();
+#ifdef DIFF_TEST
+  difftest_device_read(data);
+#endif
   return data;
 }
 
@@ -59,6 +101,11 @@ void mmio_write(paddr_t addr, int len, uint32_t data, int map_NO) {
   uint8_t *p = map->mmio_space + (addr - map->low);
   uint8_t *p_data = (uint8_t *)&data;
 
+#ifdef DIFF_TEST
+  if (difftest_replay_write()) return;
+  difftest_device_write();
+#endif
+  mp_lock_io();
   switch (len) {
     case 4: p[3] = p_data[3];
     case 3: p[2] = p_data[2];
@@ -67,4 +114,5 @@ void mmio_write(paddr_t addr, int len, uint32_t data, int map_NO) {
   }
 
   maps[map_NO].callback(addr, len, true);
+  mp_unlock_io();
 }
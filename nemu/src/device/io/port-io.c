@@ -1,8 +1,11 @@
 #include "common.h"
 #include "device/port-io.h"
+#include "monitor/snapshot.h"
+#include "cpu/mp.h"
+#include "monitor/diff-test.h"
 
 #define PORT_IO_SPACE_MAX 65536
-#define NR_MAP 8
+#define NR_MAP 64
 
 /* "+ 3" is for hacking, see pio_read() below */
 static uint8_t pio_space[PORT_IO_SPACE_MAX + 3];
@@ -16,24 +19,36 @@ typedef struct {
 static PIO_t maps[NR_MAP];
 static int nr_map = 0;
 
-static void pio_callback(ioaddr_t addr, int len, bool is_write) {
-  int i;
-  for (i = 0; i < nr_map; i ++) {
-    if (addr >= maps[i].low && addr + len - 1 <= maps[i].high) {
-      maps[i].callback(addr, len, is_write);
-      return;
-    }
+/* `map_NO + 1' of the map each port belongs to, 0 for none */
+static uint8_t port_map[PORT_IO_SPACE_MAX];
+
+static inline PIO_t* pio_find(ioaddr_t addr, int len) {
+  int idx = port_map[addr];
+  if (idx == 0 || addr + len - 1 > maps[idx - 1].high) {
+    return NULL;
   }
+  return &maps[idx - 1];
 }
 
 /* device interface */
+
+/* If `callback' is NULL, the ports are read-only: the device sets up their
+ * values in advance, reads do not run any callback, and writes are ignored.
+ */
 void* add_pio_map(ioaddr_t addr, int len, pio_callback_t callback) {
   assert(nr_map < NR_MAP);
   assert(addr + len <= PORT_IO_SPACE_MAX);
   maps[nr_map].low = addr;
   maps[nr_map].high = addr + len - 1;
   maps[nr_map].callback = callback;
+
+  int i;
+  for (i = addr; i < addr + len; i ++) {
+    assert(port_map[i] == 0);
+    port_map[i] = nr_map + 1;
+  }
   nr_map ++;
+  snapshot_add(pio_space + addr, len, "pio@0x%x", addr);
   return pio_space + addr;
 }
 
@@ -42,15 +57,40 @@ void* add_pio_map(ioaddr_t addr, int len, pio_callback_t callback) {
 uint32_t pio_read(ioaddr_t addr, int len) {
   assert(len == 1 || len == 2 || len == 4);
   assert(addr + len - 1 < PORT_IO_SPACE_MAX);
-  pio_callback(addr, len, false);		// prepare data to read
+#ifdef DIFF_TEST
+  /* the reference, and NEMU re-running from a checkpoint, get what NEMU has read */
+  uint32_t replayed;
+  if (difftest_replay_read(&replayed)) return replayed;
+#endif
+  PIO_t *map = pio_find(addr, len);
+  mp_lock_io();
+  if (map != NULL && map->callback != NULL) {
+    map->callback(addr, len, false);		// prepare data to read
+  }
   uint32_t data = *(uint32_t *)(pio_space + addr) & (~0u >> ((4 - len) << 3));
+  mp_unlock_io();
+#ifdef DIFF_TEST
+  difftest_device_read(data);
+#endif
   return data;
 }
 
 void pio_write(ioaddr_t addr, int len, uint32_t data) {
   assert(len == 1 || len == 2 || len == 4);
   assert(addr + len - 1 < PORT_IO_SPACE_MAX);
-  memcpy(pio_space + addr, &data, len);
-  pio_callback(addr, len, true);
+#ifdef DIFF_TEST
+  if (difftest_replay_write()) return;
+  difftest_device_write();
+#endif
+  PIO_t *map = pio_find(addr, len);
+  mp_lock_io();
+  if (map == NULL) {
+    memcpy(pio_space + addr, &data, len);
+  }
+  else if (map->callback != NULL) {
+    memcpy(pio_space + addr, &data, len);
+    map->callback(addr, len, true);
+  }
+  mp_unlock_io();
 }
 
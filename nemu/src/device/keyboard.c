@@ -1,5 +1,7 @@
 #include "device/port-io.h"
 #include "monitor/monitor.h"
+#include "device/replay.h"
+#include "monitor/snapshot.h"
 #include <SDL2/SDL.h>
 
 #define I8042_DATA_PORT 0x60
@@ -37,12 +39,27 @@ static int key_f = 0, key_r = 0;
 
 #define KEYDOWN_MASK 0x8000
 
+static inline void key_enqueue(uint32_t am_scancode) {
+  key_queue[key_r] = am_scancode;
+  key_r = (key_r + 1) % KEY_QUEUE_LEN;
+}
+
 void send_key(uint8_t scancode, bool is_keydown) {
+  /* keys come from the replay log */
+  if (replay_mode == REPLAY_PLAY) return;
+
   if (nemu_state == NEMU_RUNNING &&
       keymap[scancode] != _KEY_NONE) {
     uint32_t am_scancode = keymap[scancode] | (is_keydown ? KEYDOWN_MASK : 0);
-    key_queue[key_r] = am_scancode;
-    key_r = (key_r + 1) % KEY_QUEUE_LEN;
+    key_enqueue(replay_input(INPUT_KEY, am_scancode));
+  }
+}
+
+/* Send the keys which were pressed by now in the recorded run. */
+void replay_send_key() {
+  uint32_t am_scancode;
+  while (replay_pending(INPUT_KEY, &am_scancode)) {
+    key_enqueue(am_scancode);
   }
 }
 
@@ -67,4 +84,7 @@ void init_i8042() {
   i8042_data_port_base = add_pio_map(I8042_DATA_PORT, 4, i8042_io_handler);
   i8042_status_port_base = add_pio_map(I8042_STATUS_PORT, 1, i8042_io_handler);
   i8042_status_port_base[0] = 0x0;
+  snapshot_add(key_queue, sizeof(key_queue), "key_queue");
+  snapshot_add(&key_f, sizeof(key_f), "key_f");
+  snapshot_add(&key_r, sizeof(key_r), "key_r");
 }
@@ -0,0 +1,30 @@
+#include "device/port-io.h"
+#include "cpu/mp.h"
+
+/* The ports backing the AM Multi-Processor Extension. Note that this is
+ * not the standard.
+ * MPE_PORT + 0:  (read) the number of CPUs
+ * MPE_PORT + 4:  (read) the ID of the current CPU
+ * MPE_PORT + 8:  (write) start the other CPUs at the address written
+ * MPE_PORT + 12: (write) stop the current CPU
+ */
+#define MPE_PORT 0x4c
+#define NR_CPU_OFFSET 0
+#define CPU_ID_OFFSET 4
+#define START_OFFSET 8
+#define HALT_OFFSET 12
+
+static uint32_t *mpe_port_base;
+
+void mpe_io_handler(ioaddr_t addr, int len, bool is_write) {
+  switch (addr - MPE_PORT) {
+    case NR_CPU_OFFSET: mpe_port_base[0] = nr_cpu; break;
+    case CPU_ID_OFFSET: mpe_port_base[1] = cpu_id; break;
+    case START_OFFSET: if (is_write) mp_start(mpe_port_base[2]); break;
+    case HALT_OFFSET: if (is_write) mp_halt(); break;
+  }
+}
+
+void init_mpe() {
+  mpe_port_base = add_pio_map(MPE_PORT, 16, mpe_io_handler);
+}
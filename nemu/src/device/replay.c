@@ -0,0 +1,104 @@
+#include "device/replay.h"
+#include "device/event.h"
+#include <inttypes.h>
+#include <stdlib.h>
+
+/* The log is a magic string followed by the inputs in the order they are
+ * consumed, each stamped with `nr_guest_instr' at that time. It only
+ * advances between batches of instructions (see device/event.h), so the
+ * stamp is the count at the start of the batch which consumes the input.
+ * A key is sent between batches, so its stamp is exact, and it is sent
+ * again at the same count in replay mode. An RTC read may be anywhere in
+ * a batch, but RTC inputs are replayed in order, not by their stamps.
+ */
+
+#define REPLAY_MAGIC "NEMURPL1"
+
+typedef struct {
+  uint64_t instr;   // the count at the start of the batch
+  uint32_t val;
+  uint8_t type;
+} __attribute__((packed)) InputRecord;
+
+int replay_mode = REPLAY_OFF;
+static FILE *replay_fp = NULL;
+static InputRecord next;
+static bool has_next;
+
+static void read_next(void) {
+  has_next = (fread(&next, sizeof(next), 1, replay_fp) == 1);
+}
+
+/* Keep the records written before NEMU exits, even by a panic. */
+static void replay_close(void) {
+  if (replay_fp != NULL) {
+    fclose(replay_fp);
+    replay_fp = NULL;
+  }
+}
+
+static void replay_end(void) {
+  Log("The end of the replay log, inputs are live from now on");
+  fclose(replay_fp);
+  replay_fp = NULL;
+  replay_mode = REPLAY_OFF;
+}
+
+void init_replay(const char *file, int mode) {
+  char magic[sizeof(REPLAY_MAGIC) - 1];
+  replay_mode = mode;
+  switch (mode) {
+    case REPLAY_RECORD:
+      replay_fp = fopen(file, "wb");
+      Assert(replay_fp, "Can not open '%s'", file);
+      fwrite(REPLAY_MAGIC, sizeof(magic), 1, replay_fp);
+      fflush(replay_fp);
+      atexit(replay_close);
+      Log("Recording inputs to %s", file);
+      break;
+    case REPLAY_PLAY:
+      replay_fp = fopen(file, "rb");
+      Assert(replay_fp, "Can not open '%s'", file);
+      Assert(fread(magic, sizeof(magic), 1, replay_fp) == 1 &&
+          memcmp(magic, REPLAY_MAGIC, sizeof(magic)) == 0, "'%s' is not a replay log", file);
+      Log("Replaying inputs from %s", file);
+      read_next();
+      break;
+    default: break;
+  }
+}
+
+/* Called when a device consumes an input. In record mode `val' is logged
+ * and returned. In replay mode the recorded input is returned instead.
+ */
+uint32_t replay_input(int type, uint32_t val) {
+  if (replay_mode == REPLAY_RECORD) {
+    InputRecord r = { .instr = nr_guest_instr, .val = val, .type = type };
+    fwrite(&r, sizeof(r), 1, replay_fp);
+    /* inputs are rare, and the log of a run which aborts matters most */
+    fflush(replay_fp);
+  }
+  else if (replay_mode == REPLAY_PLAY) {
+    if (!has_next) {
+      replay_end();
+      return val;
+    }
+    Assert(next.type == type, "The guest diverges from the replay log at instruction %" PRIu64,
+        nr_guest_instr);
+    val = next.val;
+    read_next();
+  }
+  return val;
+}
+
+/* In replay mode, return true and the input in `*val' if an input of
+ * `type' was consumed by now in the recorded run.
+ */
+bool replay_pending(int type, uint32_t *val) {
+  if (replay_mode == REPLAY_PLAY && has_next && next.type == type && next.instr <= nr_guest_instr) {
+    *val = next.val;
+    read_next();
+    return true;
+  }
+  return false;
+}
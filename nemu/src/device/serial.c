@@ -24,6 +24,8 @@ void serial_io_handler(ioaddr_t addr, int len, bool is_write) {
 }
 
 void init_serial() {
-  serial_port_base = add_pio_map(SERIAL_PORT, 8, serial_io_handler);
-  serial_port_base[LSR_OFFSET] = 0x20; /* the status is always free */
+  serial_port_base = add_pio_map(SERIAL_PORT, LSR_OFFSET, serial_io_handler);
+  /* the status is always free, polling it needs no callback */
+  add_pio_map(SERIAL_PORT + LSR_OFFSET, 1, NULL);
+  serial_port_base[LSR_OFFSET] = 0x20;
 }
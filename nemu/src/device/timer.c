@@ -1,5 +1,6 @@
 #include "device/port-io.h"
 #include "monitor/monitor.h"
+#include "device/replay.h"
 #include <sys/time.h>
 
 #define RTC_PORT 0x48   // Note that this is not the standard
@@ -19,7 +20,7 @@ void rtc_io_handler(ioaddr_t addr, int len, bool is_write) {
     gettimeofday(&now, NULL);
     uint32_t seconds = now.tv_sec;
     uint32_t useconds = now.tv_usec;
-    rtc_port_base[0] = seconds * 1000 + (useconds + 500) / 1000;
+    rtc_port_base[0] = replay_input(INPUT_RTC, seconds * 1000 + (useconds + 500) / 1000);
   }
 }
 
@@ -0,0 +1,270 @@
+#include "nemu.h"
+#include "memory/cache.h"
+
+#ifdef CACHE_SIM
+
+#include "monitor/symbol.h"
+#include "monitor/stat.h"
+#include <inttypes.h>
+#include <stdlib.h>
+
+#define DEFAULT_CONFIG "l1i=32K:8:64:lru,l1d=32K:8:64:lru,l2=256K:8:64:lru"
+
+enum { POLICY_LRU, POLICY_FIFO, POLICY_RANDOM, NR_POLICY };
+static const char *policy_name[] = { "lru", "fifo", "random" };
+static const char *cache_name[] = { "l1i", "l1d", "l2" };
+
+typedef struct {
+  paddr_t tag;      // the address of the line
+  bool valid, dirty;
+  uint64_t stamp;   // the last use for LRU, or the fill for FIFO
+} CacheLine;
+
+typedef struct Cache {
+  int id;
+  uint32_t size, assoc, line, policy;
+  uint32_t nr_set;
+  CacheLine *lines;
+  struct Cache *next;   // NULL if it is backed by memory
+  /* by MEM_READ, MEM_WRITE and MEM_FETCH */
+  uint64_t access[3], miss[3];
+  uint64_t evict, writeback;
+} Cache;
+
+static Cache caches[NR_CACHE];
+/* where instructions and data are looked up first, NULL if uncached */
+static Cache *icache, *dcache;
+static uint64_t now = 0;
+static uint32_t seed = 1;
+
+/* the statistics of each guest function keyed by its start, entry 0 is
+ * the unknown one */
+typedef struct {
+  vaddr_t start;
+  uint64_t access[NR_CACHE], miss[NR_CACHE];
+} FuncStat;
+
+#define NR_FUNC_MEMO 4096        // must be a power of 2
+
+static StatTable funcs;
+/* the function of recent eips */
+static struct { vaddr_t eip; int func; } func_memo[NR_FUNC_MEMO];
+static int cur_func = 0;
+
+void cache_instr_begin(vaddr_t eip) {
+  if (!stat_is_traced()) return;
+  int i = (eip >> 2) & (NR_FUNC_MEMO - 1);
+  if (func_memo[i].eip != eip || func_memo[i].func < 0) {
+    vaddr_t start;
+    if (symbol_find(eip, &start) == NULL) start = 0;
+    func_memo[i].eip = eip;
+    func_memo[i].func = stat_get(&funcs, &start);
+  }
+  cur_func = func_memo[i].func;
+}
+
+static void cache_range(Cache *c, paddr_t addr, int len, int type);
+
+static CacheLine* victim(Cache *c, CacheLine *set) {
+  int i;
+  for (i = 0; i < c->assoc; i ++) {
+    if (!set[i].valid) return &set[i];
+  }
+  if (c->policy == POLICY_RANDOM) {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return &set[seed % c->assoc];
+  }
+  /* the least recently used, or the first filled */
+  CacheLine *v = &set[0];
+  for (i = 1; i < c->assoc; i ++) {
+    if (set[i].stamp < v->stamp) v = &set[i];
+  }
+  return v;
+}
+
+/* Access the line at `tag'. */
+static void cache_line(Cache *c, paddr_t tag, int type) {
+  CacheLine *set = &c->lines[((tag / c->line) & (c->nr_set - 1)) * c->assoc];
+  c->access[type] ++;
+  FuncStat *f = stat_entry(&funcs, cur_func);
+  f->access[c->id] ++;
+  now ++;
+
+  int i;
+  for (i = 0; i < c->assoc; i ++) {
+    if (set[i].valid && set[i].tag == tag) {
+      if (c->policy == POLICY_LRU) set[i].stamp = now;
+      if (type == MEM_WRITE) set[i].dirty = true;
+      return;
+    }
+  }
+
+  c->miss[type] ++;
+  f->miss[c->id] ++;
+  CacheLine *v = victim(c, set);
+  if (v->valid) {
+    c->evict ++;
+    if (v->dirty) {
+      c->writeback ++;
+      if (c->next != NULL) cache_range(c->next, v->tag, c->line, MEM_WRITE);
+    }
+  }
+  /* a write allocates the line too */
+  if (c->next != NULL) cache_range(c->next, tag, c->line, (type == MEM_WRITE ? MEM_READ : type));
+  v->tag = tag;
+  v->valid = true;
+  v->dirty = (type == MEM_WRITE);
+  v->stamp = now;
+}
+
+static void cache_range(Cache *c, paddr_t addr, int len, int type) {
+  paddr_t tag = addr & ~(c->line - 1);
+  for (; tag < addr + len; tag += c->line) {
+    cache_line(c, tag, type);
+  }
+}
+
+void cache_ifetch(paddr_t addr, int len) {
+  if (icache != NULL && stat_is_traced()) cache_range(icache, addr, len, MEM_FETCH);
+}
+
+void cache_data(paddr_t addr, int len, int type) {
+  if (dcache != NULL && stat_is_traced()) cache_range(dcache, addr, len, type);
+}
+
+static bool power_of_2(uint32_t x) {
+  return x != 0 && (x & (x - 1)) == 0;
+}
+
+/* Parse "name=size:assoc:line[:policy]". */
+static bool parse_cache(char *s) {
+  char *name = s, *val = strchr(s, '=');
+  if (val == NULL) return false;
+  *val ++ = '\0';
+  int id;
+  for (id = 0; id < NR_CACHE && strcmp(name, cache_name[id]) != 0; id ++);
+  if (id == NR_CACHE) return false;
+
+  Cache *c = &caches[id];
+  char *end;
+  c->size = strtoul(val, &end, 0);
+  if (*end == 'K' || *end == 'k') { c->size <<= 10; end ++; }
+  else if (*end == 'M' || *end == 'm') { c->size <<= 20; end ++; }
+  if (c->size == 0 && *end == '\0') return true;
+  if (*end != ':') return false;
+  c->assoc = strtoul(end + 1, &end, 0);
+  if (*end != ':') return false;
+  c->line = strtoul(end + 1, &end, 0);
+  if (*end == ':') {
+    char *policy = end + 1;
+    for (c->policy = 0; c->policy < NR_POLICY && strcmp(policy, policy_name[c->policy]) != 0; c->policy ++);
+    if (c->policy == NR_POLICY) return false;
+  }
+  else if (*end != '\0') return false;
+
+  if (c->assoc == 0 || !power_of_2(c->line) || c->size % (c->assoc * c->line) != 0) return false;
+  c->nr_set = c->size / (c->assoc * c->line);
+  return power_of_2(c->nr_set);
+}
+
+static void cache_exit() {
+  cache_report(30);
+}
+
+/* Build the caches from `config', which changes the default ones, and
+ * report at exit. Return false if it is malformed.
+ */
+bool init_cache(const char *config) {
+  char *s = strdup(DEFAULT_CONFIG ",");
+  if (config != NULL) {
+    s = realloc(s, strlen(s) + strlen(config) + 1);
+    strcat(s, config);
+  }
+  bool ok = true;
+  char *tok;
+  for (tok = strtok(s, ","); ok && tok != NULL; tok = strtok(NULL, ",")) {
+    ok = parse_cache(tok);
+  }
+  free(s);
+  if (!ok) return false;
+
+  int i;
+  for (i = 0; i < NR_CACHE; i ++) {
+    Cache *c = &caches[i];
+    c->id = i;
+    c->next = NULL;
+    if (c->size == 0) continue;
+    c->lines = calloc(c->nr_set * c->assoc, sizeof(*c->lines));
+    assert(c->lines != NULL);
+  }
+  Cache *l2 = (caches[CACHE_L2].size != 0 ? &caches[CACHE_L2] : NULL);
+  caches[CACHE_L1I].next = caches[CACHE_L1D].next = l2;
+  icache = (caches[CACHE_L1I].size != 0 ? &caches[CACHE_L1I] : l2);
+  dcache = (caches[CACHE_L1D].size != 0 ? &caches[CACHE_L1D] : l2);
+
+  for (i = 0; i < NR_FUNC_MEMO; i ++) {
+    func_memo[i].func = -1;
+  }
+  stat_table_init(&funcs, sizeof(FuncStat), sizeof(vaddr_t));
+  stat_get(&funcs, &(vaddr_t){ 0 });
+  atexit(cache_exit);
+  return true;
+}
+
+static uint64_t func_misses(const FuncStat *f) {
+  uint64_t n = 0;
+  int i;
+  for (i = 0; i < NR_CACHE; i ++) {
+    n += f->miss[i];
+  }
+  return n;
+}
+
+static int func_cmp(const void *a, const void *b) {
+  const FuncStat *x = a, *y = b;
+  if (x->miss[CACHE_L2] != y->miss[CACHE_L2]) return (x->miss[CACHE_L2] < y->miss[CACHE_L2]) - (x->miss[CACHE_L2] > y->miss[CACHE_L2]);
+  uint64_t mx = func_misses(x), my = func_misses(y);
+  return (mx < my) - (mx > my);
+}
+
+/* Print the statistics of each cache, and of the `top' functions with
+ * the most misses in L2, then in the L1 caches.
+ */
+void cache_report(int top) {
+  printf("cache      size  ways  line  policy        accesses          misses    miss%%       evictions      writebacks\n");
+  int i, j;
+  for (i = 0; i < NR_CACHE; i ++) {
+    Cache *c = &caches[i];
+    if (c->size == 0) continue;
+    uint64_t access = c->access[0] + c->access[1] + c->access[2];
+    uint64_t miss = c->miss[0] + c->miss[1] + c->miss[2];
+    printf("%-5s  %6uK  %4u  %4u  %-6s  %14" PRIu64 "  %14" PRIu64 "  %7.2f  %14" PRIu64 "  %14" PRIu64 "\n",
+        cache_name[i], c->size >> 10, c->assoc, c->line, policy_name[c->policy],
+        access, miss, ratio(miss, access), c->evict, c->writeback);
+  }
+
+  FuncStat *f = malloc(sizeof(*f) * (funcs.nr + 1));
+  assert(f != NULL);
+  memcpy(f, funcs.entries, sizeof(*f) * funcs.nr);
+  qsort(f, funcs.nr, sizeof(*f), func_cmp);
+  printf("\n");
+  for (i = 0; i < NR_CACHE; i ++) {
+    if (caches[i].size != 0) printf("   %3s misses   miss%%", cache_name[i]);
+  }
+  printf("  function\n");
+  char buf[SYMBOL_BUF_LEN];
+  for (j = 0; j < funcs.nr && j < top; j ++) {
+    if (func_misses(&f[j]) == 0) break;
+    for (i = 0; i < NR_CACHE; i ++) {
+      if (caches[i].size != 0) {
+        printf("  %12" PRIu64 " %6.2f", f[j].miss[i], ratio(f[j].miss[i], f[j].access[i]));
+      }
+    }
+    printf("  %s\n", f[j].start == 0 ? "(unknown)" : symbol_name(f[j].start, NULL, buf));
+  }
+  free(f);
+}
+
+#endif
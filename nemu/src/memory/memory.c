@@ -1,5 +1,12 @@
 #include "nemu.h"
 #include "device/mmio.h"
+#include "cpu/decode-cache.h"
+#include "cpu/mp.h"
+#include "monitor/diff-test.h"
+#include "monitor/watchpoint.h"
+#include <inttypes.h>
+#include <stdlib.h>
+#include <sys/mman.h>
 
 //PA4 page translate start
 
@@ -10,31 +17,137 @@
 #define PTX(va)          (((uint32_t)(va)>>12)&0x3ff)
 #define OFF(va)          ((uint32_t)(va)&0xfff)
 
-paddr_t page_translate(vaddr_t addr,bool iswrite){
+static paddr_t page_walk(vaddr_t addr,bool iswrite){
+  CR3 cr3=(CR3)cpu.CR3;
+
+  //页目录表
+  PDE* pgdirs=(PDE*)PTE_ADDR(cr3.val);
+  PDE pde=(PDE)paddr_read((uint32_t)(pgdirs+PDX(addr)),4);
+  Assert(pde.present,"addr=0x%x",addr);
+
+  //二级页表
+  PTE* ptab=(PTE*)PTE_ADDR(pde.val);
+  PTE pte=(PTE)paddr_read((uint32_t)(ptab+PTX(addr)),4);
+  Assert(pte.present,"addr=0x%x",addr);
+
+  //设置accessed与dirty
+  pde.accessed=1;
+  pte.accessed=1;
+  if(iswrite){
+    pte.dirty=1;
+  }
+
+  //计算物理地址
+  paddr_t paddr=PTE_ADDR(pte.val) | OFF(addr);
+  //printf("vaddr = 0x%x, paddr = 0x%x\n",addr,paddr);
+  return paddr;
+}
+
+/* The software TLBs remember the result of page_walk(), one for
+ * instruction fetch and one for data accesses. They are flushed when
+ * cr0 or cr3 is written, and a single page is dropped by invlpg. Each
+ * CPU has its own TLBs.
+ */
+
+#define NR_TLB 256   // must be a power of 2
+
+typedef struct {
+  bool valid;
+  uint32_t vpn;
+  uint32_t ppn;
+} TLBEntry;
+
+static CPU_LOCAL struct {
+  TLBEntry entry[NR_TLB];
+  uint64_t hit, miss;
+} itlb, dtlb;
+
+static CPU_LOCAL uint64_t nr_tlb_flush;
+
+CPU_LOCAL HostTLBEntry host_tlb_r[NR_HOST_TLB], host_tlb_w[NR_HOST_TLB];
+
+uint32_t host_tlb_w_epoch;
+CPU_LOCAL uint32_t host_tlb_w_local_epoch;
+static uint32_t host_tlb_r_epoch;
+static CPU_LOCAL uint32_t host_tlb_r_local_epoch;
+
+/* Flush `host_tlb_w' of this CPU now, and of the other CPUs when they
+ * call host_tlb_sync().
+ */
+void host_tlb_flush_write(){
+  host_tlb_w_local_epoch=__atomic_add_fetch(&host_tlb_w_epoch,1,__ATOMIC_RELAXED);
+  memset(host_tlb_w,0,sizeof(host_tlb_w));
+}
+
+void host_tlb_sync_slow(){
+  host_tlb_w_local_epoch=__atomic_load_n(&host_tlb_w_epoch,__ATOMIC_RELAXED);
+  memset(host_tlb_w,0,sizeof(host_tlb_w));
+  uint32_t r_epoch=__atomic_load_n(&host_tlb_r_epoch,__ATOMIC_RELAXED);
+  if(host_tlb_r_local_epoch!=r_epoch){
+    host_tlb_r_local_epoch=r_epoch;
+    memset(host_tlb_r,0,sizeof(host_tlb_r));
+  }
+}
+
+/* Flush both tables of all CPUs. */
+void host_tlb_flush_all(){
+  host_tlb_r_local_epoch=__atomic_add_fetch(&host_tlb_r_epoch,1,__ATOMIC_RELAXED);
+  memset(host_tlb_r,0,sizeof(host_tlb_r));
+  host_tlb_flush_write();
+}
+
+static inline void host_tlb_fill(HostTLBEntry *tlb, vaddr_t addr, paddr_t paddr){
+  paddr_t page=paddr&~PAGE_MASK;
+  if(page>=pmem_size || is_mmio_page(page)) return;
+  if(tlb==host_tlb_w && dcache_code_page[page>>12]) return;
+  /* accesses to watched pages take the slow path to be checked */
+  if(nr_mem_wp>0 && mem_wp_page(addr)) return;
+
+  HostTLBEntry *e=&tlb[(addr>>12)&(NR_HOST_TLB-1)];
+  e->tag=(addr&~PAGE_MASK)|1;
+  e->host=guest_to_host(page);
+}
+
+void tlb_flush(){
+  memset(itlb.entry,0,sizeof(itlb.entry));
+  memset(dtlb.entry,0,sizeof(dtlb.entry));
+  memset(host_tlb_r,0,sizeof(host_tlb_r));
+  memset(host_tlb_w,0,sizeof(host_tlb_w));
+  nr_tlb_flush++;
+}
+
+void tlb_flush_page(vaddr_t addr){
+  uint32_t vpn=addr>>12;
+  TLBEntry *e=&itlb.entry[vpn&(NR_TLB-1)];
+  if(e->vpn==vpn) e->valid=false;
+  e=&dtlb.entry[vpn&(NR_TLB-1)];
+  if(e->vpn==vpn) e->valid=false;
+  host_tlb_r[vpn&(NR_HOST_TLB-1)].tag=0;
+  host_tlb_w[vpn&(NR_HOST_TLB-1)].tag=0;
+}
+
+void tlb_stat(){
+  printf("itlb: %" PRIu64 " hits, %" PRIu64 " misses\n",itlb.hit,itlb.miss);
+  printf("dtlb: %" PRIu64 " hits, %" PRIu64 " misses\n",dtlb.hit,dtlb.miss);
+  printf("      %" PRIu64 " flushes\n",nr_tlb_flush);
+}
+
+paddr_t page_translate(vaddr_t addr,int type){
   CR0 cr0=(CR0)cpu.CR0;
   if(cr0.paging && cr0.protect_enable){
-    CR3 cr3=(CR3)cpu.CR3;
-
-    //页目录表
-    PDE* pgdirs=(PDE*)PTE_ADDR(cr3.val);
-    PDE pde=(PDE)paddr_read((uint32_t)(pgdirs+PDX(addr)),4);
-    Assert(pde.present,"addr=0x%x",addr);
-
-    //二级页表
-    PTE* ptab=(PTE*)PTE_ADDR(pde.val);
-    PTE pte=(PTE)paddr_read((uint32_t)(ptab+PTX(addr)),4);
-    Assert(pte.present,"addr=0x%x",addr);
-
-    //设置accessed与dirty
-    pde.accessed=1;
-    pte.accessed=1;
-    if(iswrite){
-      pte.dirty=1;
+    typeof(itlb) *tlb=(type==MEM_FETCH ? &itlb : &dtlb);
+    uint32_t vpn=addr>>12;
+    TLBEntry *e=&tlb->entry[vpn&(NR_TLB-1)];
+    if(e->valid && e->vpn==vpn){
+      tlb->hit++;
+      return (e->ppn<<12) | OFF(addr);
     }
 
-    //计算物理地址
-    paddr_t paddr=PTE_ADDR(pte.val) | OFF(addr);
-    //printf("vaddr = 0x%x, paddr = 0x%x\n",addr,paddr);
+    tlb->miss++;
+    paddr_t paddr=page_walk(addr,type==MEM_WRITE);
+    e->valid=true;
+    e->vpn=vpn;
+    e->ppn=paddr>>12;
     return paddr;
   }
   //printf("return paddr = vaddr\n");
@@ -43,17 +156,153 @@ paddr_t page_translate(vaddr_t addr,bool iswrite){
 
 //PA4 page translate end
 
-#define PMEM_SIZE (128 * 1024 * 1024)
-
 #define pmem_rw(addr, type) *(type *)({\
-    Assert(addr < PMEM_SIZE, "physical address(0x%08x) is out of bound", addr); \
+    Assert(addr < pmem_size, "physical address(0x%08x) is out of bound", addr); \
     guest_to_host(addr); \
     })
 
-uint8_t pmem[PMEM_SIZE];
+/* pmem is an anonymous mapping, so a page takes host memory only after
+ * the guest touches it. The image is mapped copy-on-write from its file,
+ * and its pages are shared by all NEMU instances running it until they
+ * are written.
+ */
+CPU_LOCAL uint8_t *pmem=NULL;
+uint32_t pmem_size=PMEM_SIZE;
+uint8_t pmem_dirty[NR_PMEM_PAGE];
+
+static bool pmem_huge=false;
+
+static void pmem_map_anonymous(int flags){
+  void *p=mmap(pmem,pmem_size,PROT_READ|PROT_WRITE,
+      MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE|flags,-1,0);
+  Assert(p!=MAP_FAILED,"Can not allocate %u bytes of pmem",pmem_size);
+  pmem=p;
+  if(pmem_huge && madvise(pmem,pmem_size,MADV_HUGEPAGE)!=0){
+    Log("Transparent huge pages are not available for pmem");
+  }
+}
+
+/* `size' should be a multiple of 4KB. If `huge' is true, pmem is backed
+ * by huge pages when possible, which saves TLB misses of the host but
+ * populates memory 2MB at a time.
+ */
+void init_pmem(uint32_t size, bool huge){
+  Assert(size>0 && size<=PMEM_MAX_SIZE && (size&PAGE_MASK)==0,"Invalid pmem size 0x%x",size);
+  pmem_size=size;
+  pmem_huge=huge;
+  pmem_map_anonymous(0);
+}
+
+/* Throw away the content of pmem, including the mapped image. The pages
+ * read as zero again, and are populated lazily.
+ */
+void pmem_reset(){
+  pmem_map_anonymous(MAP_FIXED);
+}
+
+/* Map `size' bytes of file `fd' at `addr' copy-on-write. Return false if
+ * the file can not be mapped.
+ */
+bool pmem_map_file(paddr_t addr, int fd, uint32_t size){
+  assert((addr&PAGE_MASK)==0);
+  Assert(size<=pmem_size-addr,"The image (%u bytes) does not fit in pmem",size);
+  /* the rest of the last page reads as zero */
+  uint32_t len=(size+PAGE_MASK)&~PAGE_MASK;
+  return mmap(guest_to_host(addr),len,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_FIXED,fd,0)!=MAP_FAILED;
+}
+
+/* Start tracking the pages written from now on. */
+void pmem_clear_dirty(){
+  memset(pmem_dirty,0,sizeof(pmem_dirty));
+  /* the next write to each page must take the slow path to mark it */
+  host_tlb_flush_write();
+}
+
+#ifdef DIFF_TEST
+/* The pages written by this thread since the last pmem_written_hash(),
+ * which the checkpoints of differential testing compare. The first
+ * NR_WRITTEN_LOG of them are also listed, to hash them without a scan.
+ */
+#define NR_WRITTEN_LOG 4096
+static CPU_LOCAL uint8_t pmem_written[NR_PMEM_PAGE];
+static CPU_LOCAL uint32_t written_log[NR_WRITTEN_LOG];
+static CPU_LOCAL uint32_t nr_written;
+
+static inline void pmem_mark_written(paddr_t addr){
+  uint32_t ppn=addr>>12;
+  if(!pmem_written[ppn]){
+    pmem_written[ppn]=1;
+    if(nr_written<NR_WRITTEN_LOG) written_log[nr_written]=ppn;
+    nr_written++;
+  }
+}
+
+static int ppn_cmp(const void *a, const void *b){
+  uint32_t x=*(const uint32_t *)a, y=*(const uint32_t *)b;
+  return (x>y)-(x<y);
+}
+
+static inline uint64_t hash_page(uint64_t h, uint32_t ppn){
+  paddr_t addr=ppn<<12;
+  const uint64_t *p=guest_to_host(addr);
+  int i;
+  h=(h^ppn)*1099511628211ull;
+  for(i=0;i<4096/sizeof(*p);i++){
+    h=(h^p[i])*1099511628211ull;
+  }
+  return h;
+}
+
+uint64_t pmem_written_hash(){
+  uint64_t h=14695981039346656037ull;
+  uint32_t i;
+  if(nr_written<=NR_WRITTEN_LOG){
+    /* the same pages may be written in another order */
+    qsort(written_log,nr_written,sizeof(written_log[0]),ppn_cmp);
+    for(i=0;i<nr_written;i++){
+      h=hash_page(h,written_log[i]);
+      pmem_written[written_log[i]]=0;
+    }
+  }
+  else{
+    for(i=0;i<(pmem_size>>12);i++){
+      if(pmem_written[i]){
+        h=hash_page(h,i);
+        pmem_written[i]=0;
+      }
+    }
+  }
+  nr_written=0;
+  /* the next write to each page must take the slow path to mark it */
+  memset(host_tlb_w,0,sizeof(host_tlb_w));
+  return h;
+}
+#else
+uint64_t pmem_written_hash(){
+  return 0;
+}
+#endif
+
+/* Called before the guest writes pmem at `addr'. */
+static inline void pmem_mark_write(paddr_t addr){
+#ifdef DIFF_TEST
+  pmem_mark_written(addr);
+  /* the pmem of the reference has no decode cache, and is not saved */
+  if(difftest_is_ref) return;
+#endif
+  decode_cache_check_write(addr);
+  pmem_dirty[addr>>12]=1;
+}
 
 /* Memory accessing interfaces */
 
+#ifdef CACHE_SIM
+/* MMIO is not cached */
+static inline void cache_pmem(paddr_t addr, int len, int type){
+  if(is_mmio(addr)==-1) cache_data(addr,len,type);
+}
+#endif
+
 uint32_t paddr_read(paddr_t addr, int len) {
   int r=is_mmio(addr);
   if(r==-1){
@@ -68,6 +317,7 @@ uint32_t paddr_read(paddr_t addr, int len) {
 void paddr_write(paddr_t addr, int len, uint32_t data) {
   int r=is_mmio(addr);
   if(r==-1){
+    pmem_mark_write(addr);
     memcpy(guest_to_host(addr), &data, len);
   }
   else{
@@ -75,8 +325,9 @@ void paddr_write(paddr_t addr, int len, uint32_t data) {
   }
 }
 
-uint32_t vaddr_read(vaddr_t addr, int len) {
+static inline uint32_t vaddr_read_type(vaddr_t addr, int len, int type) {
   //return paddr_read(addr, len);
+  if(nr_mem_wp>0 && type==MEM_READ) mem_wp_check(addr,len,MEM_READ,0);
   if(PTE_ADDR(addr)!=PTE_ADDR(addr+len-1)){//页基址不同说明跨页面
     //printf("error: the data pass two pages: addr = 0x%x, len = %d!\n",addr,len);
     //assert(0);
@@ -85,9 +336,15 @@ uint32_t vaddr_read(vaddr_t addr, int len) {
     int num1=0x1000-OFF(addr);
     int num2=len-num1;
     //两页分别的页首地址
-    paddr_t paddr1=page_translate(addr,false);
-    paddr_t paddr2=page_translate(addr+num1,false);
+    paddr_t paddr1=page_translate(addr,type);
+    paddr_t paddr2=page_translate(addr+num1,type);
 
+#ifdef CACHE_SIM
+    if(type==MEM_READ){
+      cache_pmem(paddr1,num1,type);
+      cache_pmem(paddr2,num2,type);
+    }
+#endif
     uint32_t low=paddr_read(paddr1,num1);
     uint32_t high=paddr_read(paddr2,num2);
 
@@ -95,30 +352,140 @@ uint32_t vaddr_read(vaddr_t addr, int len) {
     return result;
   }
   else{
-    paddr_t paddr=page_translate(addr,false);
+    paddr_t paddr=page_translate(addr,type);
+    if(type==MEM_READ){
+      host_tlb_fill(host_tlb_r,addr,paddr);
+#ifdef CACHE_SIM
+      cache_pmem(paddr,len,type);
+#endif
+    }
     return paddr_read(paddr,len);
   }
 }
 
-void vaddr_write(vaddr_t addr, int len, uint32_t data) {
+/* called by vaddr_read() if the page is not in `host_tlb_r' */
+uint32_t vaddr_read_slow(vaddr_t addr, int len) {
+  return vaddr_read_type(addr, len, MEM_READ);
+}
+
+uint32_t vaddr_ifetch(vaddr_t addr, int len) {
+  return vaddr_read_type(addr, len, MEM_FETCH);
+}
+
+/* called by vaddr_write() if the page is not in `host_tlb_w' */
+void vaddr_write_slow(vaddr_t addr, int len, uint32_t data) {
   //paddr_write(addr, len, data);
+  if(nr_mem_wp>0) mem_wp_check(addr,len,MEM_WRITE,data);
   if(PTE_ADDR(addr)!=PTE_ADDR(addr+len-1)){
     //printf("error: the data pass two pages: addr = 0x%x, len = %d!\n",addr,len);
     //assert(0);
     int num1=0x1000-OFF(addr);
     int num2=len-num1;
 
-    paddr_t paddr1=page_translate(addr,true);
-    paddr_t paddr2=page_translate(addr+num1,true);
+    paddr_t paddr1=page_translate(addr,MEM_WRITE);
+    paddr_t paddr2=page_translate(addr+num1,MEM_WRITE);
 
     uint32_t low=data & (~0u >> ((4-num1) << 3));
     uint32_t high=data >> ((4-num2) << 3);
 
+#ifdef CACHE_SIM
+    cache_pmem(paddr1,num1,MEM_WRITE);
+    cache_pmem(paddr2,num2,MEM_WRITE);
+#endif
     paddr_write(paddr1,num1,low);
     paddr_write(paddr2,num2,high);
   }
   else{
-    paddr_t paddr=page_translate(addr,true);
+    paddr_t paddr=page_translate(addr,MEM_WRITE);
+#ifdef CACHE_SIM
+    cache_pmem(paddr,len,MEM_WRITE);
+#endif
     paddr_write(paddr,len,data);
+    host_tlb_fill(host_tlb_w,addr,paddr);
+  }
+}
+
+/* Return the host address of `len' bytes at `addr' which are going to be
+ * written atomically, or NULL if they cross pages or are not in pmem.
+ */
+static uint8_t* atomic_host_addr(vaddr_t addr, int len){
+  if(PTE_ADDR(addr)!=PTE_ADDR(addr+len-1)) return NULL;
+  /* the read and the write are checked one by one */
+  if(nr_mem_wp>0 && mem_wp_page(addr)) return NULL;
+  paddr_t paddr=page_translate(addr,MEM_WRITE);
+  if(paddr>=pmem_size || is_mmio(paddr)!=-1) return NULL;
+  pmem_mark_write(paddr);
+#ifdef CACHE_SIM
+  cache_data(paddr,len,MEM_READ);
+  cache_data(paddr,len,MEM_WRITE);
+#endif
+  return guest_to_host(paddr);
+}
+
+/* Swap `data' with the memory at `addr' atomically. Like the locked
+ * instructions, it holds the bus lock, so the slow path of a watched
+ * page, a page boundary or MMIO is atomic too. In pmem, it is also
+ * atomic against plain writes of other CPUs. Return the old value.
+ */
+uint32_t vaddr_xchg(vaddr_t addr, int len, uint32_t data){
+  uint32_t old=0;
+  mp_lock_bus();
+  uint8_t *p=atomic_host_addr(addr,len);
+  switch(p==NULL?0:len){
+    case 4: old=__atomic_exchange_n((uint32_t *)p,data,__ATOMIC_SEQ_CST); break;
+    case 2: old=__atomic_exchange_n((uint16_t *)p,data,__ATOMIC_SEQ_CST); break;
+    case 1: old=__atomic_exchange_n(p,data,__ATOMIC_SEQ_CST); break;
+    default:
+      old=vaddr_read(addr,len);
+      vaddr_write(addr,len,data);
+  }
+  mp_unlock_bus();
+  return old;
+}
+
+/* Replace the memory at `addr' with `data' atomically if it equals `cmp',
+ * under the bus lock like vaddr_xchg(). Return the old value.
+ */
+uint32_t vaddr_cmpxchg(vaddr_t addr, int len, uint32_t cmp, uint32_t data){
+  uint32_t old=0;
+  mp_lock_bus();
+  uint8_t *p=atomic_host_addr(addr,len);
+  switch(p==NULL?0:len){
+    case 4: { uint32_t v=cmp; __atomic_compare_exchange_n((uint32_t *)p,&v,data,false,__ATOMIC_SEQ_CST,__ATOMIC_SEQ_CST); old=v; break; }
+    case 2: { uint16_t v=cmp; __atomic_compare_exchange_n((uint16_t *)p,&v,data,false,__ATOMIC_SEQ_CST,__ATOMIC_SEQ_CST); old=v; break; }
+    case 1: { uint8_t v=cmp; __atomic_compare_exchange_n(p,&v,data,false,__ATOMIC_SEQ_CST,__ATOMIC_SEQ_CST); old=v; break; }
+    default:
+      old=vaddr_read(addr,len);
+      if(old==cmp){
+        vaddr_write(addr,len,data);
+      }
+  }
+  mp_unlock_bus();
+  return old;
+}
+
+static inline bool pmem_peek(paddr_t addr, int len, uint32_t *data){
+  if(addr>=pmem_size || pmem_size-addr<len || is_mmio(addr)!=-1) return false;
+  *data=0;
+  memcpy(data,guest_to_host(addr),len);
+  return true;
+}
+
+/* Read `len' (1, 2 or 4) bytes at `addr' for the monitor, e.g. to walk
+ * the guest stack. Unlike vaddr_read(), it fails instead of aborting NEMU
+ * if the page is not present or it is MMIO, and does not touch the TLBs,
+ * devices or watchpoints.
+ */
+bool vaddr_peek(vaddr_t addr, int len, uint32_t *data){
+  if(PTE_ADDR(addr)!=PTE_ADDR(addr+len-1)) return false;
+  paddr_t paddr=addr;
+  CR0 cr0=(CR0)cpu.CR0;
+  if(cr0.paging && cr0.protect_enable){
+    PDE pde;
+    PTE pte;
+    if(!pmem_peek(PTE_ADDR(cpu.CR3)+PDX(addr)*4,4,&pde.val) || !pde.present) return false;
+    if(!pmem_peek(PTE_ADDR(pde.val)+PTX(addr)*4,4,&pte.val) || !pte.present) return false;
+    paddr=PTE_ADDR(pte.val) | OFF(addr);
   }
+  return pmem_peek(paddr,len,data);
 }
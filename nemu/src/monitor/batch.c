@@ -0,0 +1,164 @@
+#include "nemu.h"
+#include "monitor/monitor.h"
+#include "monitor/batch.h"
+#include "device/event.h"
+#include "misc/io.h"
+#include <inttypes.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+void cpu_exec(uint64_t);
+
+enum { RESULT_PASS, RESULT_FAIL, RESULT_INVALID, RESULT_LIMIT, RESULT_TIMEOUT, RESULT_ABORT };
+static const char *result_name[] = {
+  [RESULT_PASS] = "PASS", [RESULT_FAIL] = "FAIL", [RESULT_INVALID] = "INVALID",
+  [RESULT_LIMIT] = "LIMIT", [RESULT_TIMEOUT] = "TIMEOUT", [RESULT_ABORT] = "ABORT",
+};
+
+/* sent from a worker to the monitor through a pipe */
+typedef struct {
+  int result;
+  uint64_t instr;
+  double time;
+} Result;
+
+typedef struct {
+  pid_t pid;
+  int pipe;
+  FILE *log;
+  Result res;
+} Job;
+
+static int result_fd;
+static struct timespec start_time;
+
+static double elapsed() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start_time.tv_sec) + (now.tv_nsec - start_time.tv_nsec) * 1e-9;
+}
+
+static void send_result(int result) {
+  Result res = { .result = result, .instr = nr_guest_instr, .time = elapsed() };
+  write_all(result_fd, &res, sizeof(res));
+}
+
+static void timeout_handler(int sig) {
+  send_result(RESULT_TIMEOUT);
+  _exit(0);
+}
+
+/* The body of a worker, which never returns. */
+static void worker(const char *img, uint64_t instr_limit, int time_limit,
+    void (*load)(const char *)) {
+  load(img);
+
+  signal(SIGALRM, timeout_handler);
+  alarm(time_limit);
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
+
+  cpu_exec(instr_limit);
+
+  alarm(0);
+  fflush(stdout);
+  fflush(stderr);
+  switch (nemu_trap_state) {
+    case TRAP_GOOD: send_result(RESULT_PASS); break;
+    case TRAP_BAD: send_result(RESULT_FAIL); break;
+    default: send_result(nemu_state == NEMU_END ? RESULT_INVALID : RESULT_LIMIT); break;
+  }
+  _exit(0);
+}
+
+static void start_job(Job *job, const char *img, uint64_t instr_limit, int time_limit,
+    void (*load)(const char *)) {
+  int fd[2];
+  int ret = pipe(fd);
+  Assert(ret == 0, "Can not create a pipe");
+  /* the output of a worker is kept, and shown if the image does not pass */
+  job->log = tmpfile();
+  Assert(job->log, "Can not create a log file");
+  fflush(stdout);
+  fflush(stderr);
+
+  job->pid = fork();
+  Assert(job->pid >= 0, "Can not fork a worker");
+  if (job->pid == 0) {
+    close(fd[0]);
+    result_fd = fd[1];
+    dup2(fileno(job->log), STDOUT_FILENO);
+    dup2(fileno(job->log), STDERR_FILENO);
+    worker(img, instr_limit, time_limit, load);
+  }
+
+  close(fd[1]);
+  job->pipe = fd[0];
+}
+
+static void finish_job(Job *job, const char *img, int status) {
+  /* a worker which dies before sending its result has aborted */
+  if (!read_all(job->pipe, &job->res, sizeof(job->res))) {
+    job->res.result = RESULT_ABORT;
+  }
+  close(job->pipe);
+  job->pid = 0;
+
+  if (job->res.result != RESULT_PASS) {
+    fprintf(stderr, "===== %s: %s =====\n", img, result_name[job->res.result]);
+    if (!WIFEXITED(status)) {
+      fprintf(stderr, "killed by signal %d\n", WTERMSIG(status));
+    }
+    rewind(job->log);
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), job->log)) > 0) {
+      fwrite(buf, 1, n, stderr);
+    }
+  }
+  fclose(job->log);
+}
+
+void batch_run(char **imgs, int nr_img, int nr_worker, uint64_t instr_limit, int time_limit,
+    void (*load)(const char *)) {
+  Job *jobs = calloc(nr_img, sizeof(Job));
+  assert(jobs);
+  if (nr_worker <= 0) nr_worker = sysconf(_SC_NPROCESSORS_ONLN);
+  if (nr_worker <= 0) nr_worker = 1;
+
+  int next = 0, nr_running = 0, nr_pass = 0, i;
+  while (next < nr_img || nr_running > 0) {
+    while (next < nr_img && nr_running < nr_worker) {
+      start_job(&jobs[next], imgs[next], instr_limit, time_limit, load);
+      next ++;
+      nr_running ++;
+    }
+
+    int status;
+    pid_t pid = wait(&status);
+    Assert(pid > 0, "No worker to wait for");
+    for (i = 0; i < next; i ++) {
+      if (jobs[i].pid == pid) {
+        finish_job(&jobs[i], imgs[i], status);
+        nr_running --;
+        break;
+      }
+    }
+  }
+
+  /* one line for each image: name, result, instructions, seconds, MIPS */
+  printf("# image\tresult\tinstr\ttime\tMIPS\n");
+  for (i = 0; i < nr_img; i ++) {
+    Result *r = &jobs[i].res;
+    printf("%s\t%s\t%" PRIu64 "\t%.6f\t%.2f\n", imgs[i], result_name[r->result], r->instr, r->time,
+        r->time > 0 ? r->instr / r->time / 1e6 : 0.0);
+    if (r->result == RESULT_PASS) nr_pass ++;
+  }
+  printf("# %d passed, %d failed\n", nr_pass, nr_img - nr_pass);
+  fflush(stdout);
+
+  free(jobs);
+  exit(nr_pass == nr_img ? 0 : 1);
+}
@@ -1,6 +1,11 @@
 #include "nemu.h"
 #include "monitor/monitor.h"
 #include "monitor/watchpoint.h"
+#include "device/event.h"
+#include "cpu/mp.h"
+#include "monitor/diff-test.h"
+#include "monitor/itrace.h"
+#include "monitor/ftrace.h"
 
 /* The assembly code of instructions executed is only output to the screen
  * when the number of instructions executed is less than this value.
@@ -10,8 +15,11 @@
 #define MAX_INSTR_TO_PRINT 10
 
 int nemu_state = NEMU_STOP;
+int nemu_trap_state = TRAP_NONE;
+CPU_LOCAL bool cpu_exec_active = false;
 
 void exec_wrapper(bool);
+uint32_t exec_block(uint64_t);
 
 /* Simulate how the CPU works. */
 void cpu_exec(uint64_t n)
@@ -22,14 +30,33 @@ void cpu_exec(uint64_t n)
     return;
   }
   nemu_state = NEMU_RUNNING;
+  cpu_exec_active = true;
+  /* the other CPUs run together with CPU 0 */
+  mp_resume();
 
+#ifndef BLOCK_ENGINE
   bool print_flag = n < MAX_INSTR_TO_PRINT;
+#endif
 
-  for (; n > 0; n--)
+  while (n > 0)
   {
+    host_tlb_sync();
+
+#ifdef BLOCK_ENGINE
+    /* Execute a basic block, but no more than n instructions,
+     * and stop at the next device event. */
+    uint64_t budget = event_budget(n);
+#ifdef DIFF_TEST
+    budget = difftest_budget(budget);
+#endif
+    uint32_t count = exec_block(budget);
+#else
     /* Execute one instruction, including instruction fetch,
      * instruction decode, and the actual execution. */
     exec_wrapper(print_flag);
+    uint32_t count = 1;
+#endif
+    n -= count;
 
 #ifdef DEBUG
     /* TODO: check watchpoints here. */
@@ -40,17 +67,36 @@ void cpu_exec(uint64_t n)
 
 #endif
 
-#ifdef HAS_IOE
-    extern void device_update();
-    device_update();
+    /* Run the device events which are due. */
+    event_advance(count);
+
+    /* Stamp the calls and returns of the batch. */
+    if (ftrace_on) ftrace_commit();
+
+#ifdef DIFF_TEST
+    difftest_step(count);
 #endif
 
     if (nemu_state != NEMU_RUNNING)
     {
-      return;
+      break;
     }
   }
 
+  mp_pause();
+  cpu_exec_active = false;
+
+#ifdef DIFF_TEST
+  difftest_sync();
+#endif
+
+#ifdef ITRACE
+  /* keep the instructions before a bad trap, an invalid opcode or a diff */
+  if (nemu_state == NEMU_END && nemu_trap_state != TRAP_GOOD) {
+    itrace_dump(NULL);
+  }
+#endif
+
   if (nemu_state == NEMU_RUNNING)
   {
     nemu_state = NEMU_STOP;
@@ -1,4 +1,5 @@
 #include "nemu.h"
+#include "monitor/expr.h"
 
 /* We use the POSIX regex functions to process regular expressions.
  * Type 'man regex' for more information about POSIX regex functions.
@@ -21,6 +22,12 @@ enum
 
   /* TODO: Add more token types */
 
+  /* operands of compiled expressions */
+  OP_NUM,
+  OP_REG32,
+  OP_REG16,
+  OP_REG8,
+  OP_EIP,
 };
 
 static struct rule
@@ -81,7 +88,7 @@ typedef struct token
   char str[32];
 } Token;
 
-Token tokens[32];
+Token tokens[NR_EXPR_OP];
 int nr_token;
 
 static bool make_token(char *e)
@@ -106,21 +113,25 @@ static bool make_token(char *e)
         Log("match rules[%d] = \"%s\" at position %d with len %d: %.*s",
             i, rules[i].regex, position, substr_len, substr_len, substr_start);
             */
-        position += substr_len;
-        
-
         /* TODO: Now a new token is recognized with rules[i]. Add codes
          * to record the token in the array `tokens'. For certain types
          * of tokens, some extra actions should be performed.
          */
-        if (substr_len > 31)
-        { //32 or 31?
-          assert(0);
+        if (rules[i].token_type != TK_NOTYPE && substr_len >= sizeof(tokens[0].str))
+        {
+          printf("token too long at position %d\n%s\n%*.s^\n", position, e, position, "");
+          return false;
         }
+        position += substr_len;
         if (rules[i].token_type == TK_NOTYPE)
         {
           break;
         }
+        if (nr_token == NR_EXPR_OP)
+        {
+          printf("too many tokens in the expression\n");
+          return false;
+        }
         tokens[nr_token].type = rules[i].token_type;
         switch (rules[i].token_type)
         {
@@ -250,144 +261,200 @@ int findDominantOp(int p, int q)
       return pos[i];
     }
   }
-  for (int i = 0; i < 5; i++)
+  printf("error in findDominantOp(): no operator between p = %d and q = %d\n", p, q);
+  return -1;
+}
+
+static bool emit(CompiledExpr *ce, int type, uint32_t val)
+{
+  ce->op[ce->nr_op].type = type;
+  ce->op[ce->nr_op].val = val;
+  ce->nr_op++;
+  return true;
+}
+
+static bool compile_operand(Token *t, CompiledExpr *ce)
+{
+  uint32_t num;
+  switch (t->type)
   {
-    printf("%d", pos[i]);
+  case TK_NUMBER:
+    sscanf(t->str, "%u", &num);
+    return emit(ce, OP_NUM, num);
+  case TK_HEX:
+    sscanf(t->str, "%x", &num);
+    return emit(ce, OP_NUM, num);
+  case TK_REG:
+    if (strcmp(t->str, "eip") == 0)
+    {
+      return emit(ce, OP_EIP, 0);
+    }
+    for (int i = 0; i < 8; i++)
+    {
+      if (strcmp(t->str, regsl[i]) == 0)
+      {
+        return emit(ce, OP_REG32, i);
+      }
+      if (strcmp(t->str, regsw[i]) == 0)
+      {
+        return emit(ce, OP_REG16, i);
+      }
+      if (strcmp(t->str, regsb[i]) == 0)
+      {
+        return emit(ce, OP_REG8, i);
+      }
+    }
   }
-  printf("error in findDominantOp(): p = %d, q = %d", p, q);
-  assert(0);
+  printf("bad operand in compile()\n");
+  return false;
 }
 
-uint32_t eval(int p, int q)
+/* Each token becomes at most one operation, so there is room for them. */
+static bool compile(int p, int q, CompiledExpr *ce)
 {
   if (p > q)
   {
-    printf("bad expression in eval() : p > q\n");
-    assert(0);
+    printf("bad expression in compile() : p > q\n");
+    return false;
   }
   else if (p == q)
   {
-    int num;
-    switch (tokens[p].type)
-    {
-    case TK_NUMBER:
-      sscanf(tokens[p].str, "%d", &num);
-      return num;
-    case TK_HEX:
-      sscanf(tokens[p].str, "%x", &num);
-      return num;
-    case TK_REG:
-      for (int i = 0; i < 8; i++)
-      {
-        if (strcmp(tokens[p].str, regsl[i]) == 0)
-        {
-          return reg_l(i); //reg_l()报错undeclared？
-        }
-        if (strcmp(tokens[p].str, regsw[i]) == 0)
-        {
-          return reg_w(i);
-        }
-        if (strcmp(tokens[p].str, regsb[i]) == 0)
-        {
-          return reg_b(i);
-        }
-        if (strcmp(tokens[p].str, "eip") == 0)
-        {
-          return cpu.eip;
-        }
-        if (strcmp(tokens[p].str, "esp") == 0)
-        {
-          return cpu.esp;
-        }
-        if (strcmp(tokens[p].str, "ebp") == 0)
-        {
-          return cpu.ebp;
-        }
-        if (strcmp(tokens[p].str, "esi") == 0)
-        {
-          return cpu.esi;
-        }
-        if (strcmp(tokens[p].str, "edi") == 0)
-        {
-          return cpu.edi;
-        }
-      }
-    }
+    return compile_operand(&tokens[p], ce);
   }
   else if (check_parentheses(p, q) == true)
   {
-    return eval(p + 1, q - 1);
+    return compile(p + 1, q - 1, ce);
   }
-  else
+
+  int op = findDominantOp(p, q);
+  if (op < 0)
   {
-    int op = findDominantOp(p, q);
-    vaddr_t addr;
-    uint32_t result;
-    if (op == -1)
+    return false;
+  }
+  switch (tokens[op].type)
+  {
+  case TK_NEG:
+  case TK_DEREF:
+  case '!':
+    /* no binary operator at this level, so it starts with a unary one */
+    if (tokens[p].type != TK_NEG && tokens[p].type != TK_DEREF && tokens[p].type != '!')
     {
-      assert(0);
+      printf("bad expression in compile() : no operator at position %d\n", p);
+      return false;
     }
-    //printf("dominant op is %d at position %d\n", tokens[op].type, op);
-    switch (tokens[op].type)
+    return compile(p + 1, q, ce) && emit(ce, tokens[p].type, 0);
+  }
+  return compile(p, op - 1, ce) && compile(op + 1, q, ce) && emit(ce, tokens[op].type, 0);
+}
+
+/* Return false if the expression can not be evaluated, e.g. on a
+ * division by zero. An expression given to the monitor reads memory as
+ * the guest does, and prints it. Otherwise, e.g. for a watchpoint checked
+ * after each instruction, memory is only peeked, so devices, the TLBs and
+ * memory watchpoints are not touched, and MMIO can not be evaluated.
+ */
+static bool run(const CompiledExpr *ce, bool interactive, uint32_t *result)
+{
+  uint32_t stack[NR_EXPR_OP];
+  int sp = 0;
+  for (int i = 0; i < ce->nr_op; i++)
+  {
+    uint32_t val = ce->op[i].val;
+    switch (ce->op[i].type)
     {
+    case OP_NUM:
+      stack[sp++] = val;
+      break;
+    case OP_REG32:
+      stack[sp++] = reg_l(val);
+      break;
+    case OP_REG16:
+      stack[sp++] = reg_w(val);
+      break;
+    case OP_REG8:
+      stack[sp++] = reg_b(val);
+      break;
+    case OP_EIP:
+      stack[sp++] = cpu.eip;
+      break;
     case TK_NEG:
-      return -eval(p + 1, q);
+      stack[sp - 1] = -stack[sp - 1];
+      break;
     case TK_DEREF:
-      addr = eval(p + 1, q);
-      result = vaddr_read(addr, 4);
-      printf("addr = %u(0x%x) ----> value = %d(0x%08x)\n", addr, addr, result, result);
-      return result;
-    case '!':
-      result = eval(p + 1, q);
-      if (result != 0)
+      if (!interactive)
       {
-        return 0;
+        if (!vaddr_peek(stack[sp - 1], 4, &val))
+        {
+          return false;
+        }
       }
       else
       {
-        return 1;
+        val = vaddr_read(stack[sp - 1], 4);
+        printf("addr = %u(0x%x) ----> value = %d(0x%08x)\n", stack[sp - 1], stack[sp - 1], val, val);
       }
-    }
-
-    uint32_t val_1 = eval(p, op - 1);
-    uint32_t val_2 = eval(op + 1, q);
-    switch (tokens[op].type)
-    {
-    case '+':
-      return val_1 + val_2;
-    case '-':
-      return val_1 - val_2;
-    case '*':
-      return val_1 * val_2;
-    case '/':
-      return val_1 / val_2;
-    case TK_EQ:
-      return val_1 == val_2;
-    case TK_NEQ:
-      return val_1 != val_2;
-    case TK_AND:
-      return val_1 && val_2;
-    case TK_OR:
-      return val_1 || val_2;
+      stack[sp - 1] = val;
+      break;
+    case '!':
+      stack[sp - 1] = !stack[sp - 1];
+      break;
     default:
-      printf("error in eval()\n");
-      assert(0);
+      /* a binary operator */
+      sp--;
+      val = stack[sp];
+      switch (ce->op[i].type)
+      {
+      case '+':
+        stack[sp - 1] += val;
+        break;
+      case '-':
+        stack[sp - 1] -= val;
+        break;
+      case '*':
+        stack[sp - 1] *= val;
+        break;
+      case '/':
+        if (val == 0)
+        {
+          printf("division by zero in run()\n");
+          return false;
+        }
+        stack[sp - 1] /= val;
+        break;
+      case TK_EQ:
+        stack[sp - 1] = (stack[sp - 1] == val);
+        break;
+      case TK_NEQ:
+        stack[sp - 1] = (stack[sp - 1] != val);
+        break;
+      case TK_AND:
+        stack[sp - 1] = (stack[sp - 1] && val);
+        break;
+      case TK_OR:
+        stack[sp - 1] = (stack[sp - 1] || val);
+        break;
+      default:
+        printf("error in run()\n");
+        assert(0);
+      }
     }
   }
-  return 0; //???
+  *result = stack[0];
+  return true;
 }
 
-uint32_t expr(char *e, bool *success)
+bool expr_eval(const CompiledExpr *ce, uint32_t *result)
+{
+  return run(ce, false, result);
+}
+
+bool expr_compile(char *e, CompiledExpr *ce)
 {
   if (!make_token(e))
   {
-    *success = false;
-    return 0;
+    return false;
   }
 
-  /* TODO: Insert codes to evaluate the expression. */
-  //TODO();
-  *success = true;
   //识别负号与解引用
   if (nr_token != 1)
   {
@@ -421,5 +488,14 @@ uint32_t expr(char *e, bool *success)
       }
     }
   }
-  return eval(0, nr_token - 1);
+  ce->nr_op = 0;
+  return compile(0, nr_token - 1, ce);
+}
+
+uint32_t expr(char *e, bool *success)
+{
+  CompiledExpr ce;
+  uint32_t result = 0;
+  *success = expr_compile(e, &ce) && run(&ce, true, &result);
+  return result;
 }
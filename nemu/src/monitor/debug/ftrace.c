@@ -0,0 +1,222 @@
+#include "nemu.h"
+#include "monitor/ftrace.h"
+#include "monitor/symbol.h"
+#include "monitor/stat.h"
+#include "device/event.h"
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+/* The instructions which change the flow end a block, so the events of a
+ * batch of instructions happen at its end. They are kept until the batch
+ * is over, then stamped with the number of instructions executed.
+ */
+#define NR_PENDING 16
+#define NR_LOG_BUF 4096
+
+/* the caller of the outermost calls */
+#define ROOT 0xffffffff
+
+typedef struct {
+  int kind;
+  vaddr_t pc, target, slot;
+} Event;
+
+/* a function, or an edge of the call graph, keyed by (caller, callee) */
+typedef struct {
+  vaddr_t caller, callee;
+  uint64_t calls, incl, excl;
+  uint32_t active;   // the calls on the stack, only the outermost is inclusive
+} Stat;
+
+typedef struct {
+  vaddr_t slot;
+  uint64_t start, child;
+  int func, edge;
+} Frame;
+
+bool ftrace_on = false;
+
+static Event pending[NR_PENDING];
+static int nr_pending = 0;
+
+static Frame stack[FTRACE_MAX_DEPTH];
+static int depth = 0;
+static StatTable funcs, edges;
+static uint64_t nr_call = 0, nr_unmatched = 0, start_instr = 0;
+
+static FILE *ftrace_fp = NULL;
+static FTraceRecord log_buf[NR_LOG_BUF];
+static int nr_log = 0;
+
+static void log_flush() {
+  if (ftrace_fp != NULL && nr_log > 0) {
+    fwrite(log_buf, sizeof(log_buf[0]), nr_log, ftrace_fp);
+    fflush(ftrace_fp);
+  }
+  nr_log = 0;
+}
+
+static void log_event(uint64_t instr, int kind, vaddr_t pc, vaddr_t target) {
+  if (ftrace_fp == NULL) return;
+  if (nr_log == NR_LOG_BUF) log_flush();
+  FTraceRecord *r = &log_buf[nr_log ++];
+  memset(r, 0, sizeof(*r));
+  r->instr = instr;
+  r->pc = pc;
+  r->target = target;
+  r->kind = kind;
+  r->depth = depth;
+}
+
+/* Return from the call on the top of `s' at `now'. */
+static void frame_pop(Frame *s, int *d, Stat *f, Stat *e, uint64_t now) {
+  Frame *fr = &s[-- *d];
+  uint64_t len = now - fr->start;
+  f[fr->func].excl += len - fr->child;
+  if (-- f[fr->func].active == 0) f[fr->func].incl += len;
+  if (-- e[fr->edge].active == 0) e[fr->edge].incl += len;
+  if (*d > 0) s[*d - 1].child += len;
+}
+
+static void do_call(const Event *ev, uint64_t now) {
+  if (depth == FTRACE_MAX_DEPTH) {
+    log_event(now, ev->kind, ev->pc, ev->target);
+    return;
+  }
+
+  vaddr_t key;
+  char buf[SYMBOL_BUF_LEN];
+  symbol_name(ev->target, &key, buf);
+  vaddr_t caller = (depth == 0 ? ROOT : ((Stat *)funcs.entries)[stack[depth - 1].func].callee);
+  Frame *fr = &stack[depth ++];
+  fr->slot = ev->slot;
+  fr->start = now;
+  fr->child = 0;
+  fr->func = stat_get(&funcs, (vaddr_t []){ ROOT, key });
+  fr->edge = stat_get(&edges, (vaddr_t []){ caller, key });
+  Stat *f = stat_entry(&funcs, fr->func), *e = stat_entry(&edges, fr->edge);
+  f->calls ++;
+  f->active ++;
+  e->calls ++;
+  e->active ++;
+  nr_call ++;
+
+  log_event(now, ev->kind, ev->pc, key);
+}
+
+static void do_ret(const Event *ev, uint64_t now) {
+  int i;
+  for (i = depth - 1; i >= 0 && stack[i].slot != ev->slot; i --);
+  if (i < 0) {
+    nr_unmatched ++;
+    log_event(now, ev->kind, ev->pc, 0);
+    return;
+  }
+
+  vaddr_t key = ((Stat *)funcs.entries)[stack[i].func].callee;
+  /* the calls skipped, e.g. by a longjmp, return too */
+  while (depth > i) {
+    frame_pop(stack, &depth, funcs.entries, edges.entries, now);
+  }
+  log_event(now, ev->kind, ev->pc, key);
+}
+
+void ftrace_event(int kind, vaddr_t pc, vaddr_t target, vaddr_t slot) {
+  if (!stat_is_traced()) return;
+  if (nr_pending == NR_PENDING) ftrace_commit();
+  pending[nr_pending ++] = (Event){ kind, pc, target, slot };
+}
+
+void ftrace_commit() {
+  int i;
+  for (i = 0; i < nr_pending; i ++) {
+    const Event *ev = &pending[i];
+    if (ev->kind == FTRACE_CALL || ev->kind == FTRACE_INTR) do_call(ev, nr_guest_instr);
+    else do_ret(ev, nr_guest_instr);
+  }
+  nr_pending = 0;
+}
+
+static const char* func_name(vaddr_t key, char *buf) {
+  return (key == ROOT ? "(root)" : symbol_name(key, NULL, buf));
+}
+
+static int stat_incl_cmp(const void *a, const void *b) {
+  const Stat *x = a, *y = b;
+  if (x->incl != y->incl) return (x->incl < y->incl) - (x->incl > y->incl);
+  return (x->calls < y->calls) - (x->calls > y->calls);
+}
+
+static Stat* stat_copy(const StatTable *t) {
+  Stat *s = malloc(sizeof(*s) * (t->nr + 1));
+  assert(s != NULL);
+  memcpy(s, t->entries, sizeof(*s) * t->nr);
+  return s;
+}
+
+/* Print the `top' functions and calls with the most instructions in them,
+ * including the functions they call. The calls on the stack count until
+ * now.
+ */
+void ftrace_report(int top) {
+  if (nr_call == 0) {
+    printf("No calls traced yet\n");
+    return;
+  }
+
+  /* return from all calls on copies */
+  Stat *f = stat_copy(&funcs), *e = stat_copy(&edges);
+  Frame *s = malloc(sizeof(*s) * (depth + 1));
+  assert(s != NULL);
+  memcpy(s, stack, sizeof(*s) * depth);
+  int d = depth;
+  while (d > 0) {
+    frame_pop(s, &d, f, e, nr_guest_instr);
+  }
+  free(s);
+
+  uint64_t total = nr_guest_instr - start_instr;
+  printf("%" PRIu64 " calls in %" PRIu64 " instructions, %" PRIu64 " returns unmatched, depth %d\n",
+      nr_call, total, nr_unmatched, depth);
+
+  char buf[SYMBOL_BUF_LEN], buf2[SYMBOL_BUF_LEN];
+  qsort(f, funcs.nr, sizeof(*f), stat_incl_cmp);
+  printf("       calls       inclusive       %%       exclusive       %%  function\n");
+  uint32_t i;
+  for (i = 0; i < funcs.nr && i < top; i ++) {
+    printf("%12" PRIu64 " %15" PRIu64 " %7.2f %15" PRIu64 " %7.2f  %s\n", f[i].calls,
+        f[i].incl, ratio(f[i].incl, total), f[i].excl, ratio(f[i].excl, total),
+        func_name(f[i].callee, buf));
+  }
+
+  qsort(e, edges.nr, sizeof(*e), stat_incl_cmp);
+  printf("       calls       inclusive       %%  caller -> callee\n");
+  for (i = 0; i < edges.nr && i < top; i ++) {
+    printf("%12" PRIu64 " %15" PRIu64 " %7.2f  %s -> %s\n", e[i].calls, e[i].incl,
+        ratio(e[i].incl, total), func_name(e[i].caller, buf), func_name(e[i].callee, buf2));
+  }
+  free(f);
+  free(e);
+}
+
+static void ftrace_exit() {
+  ftrace_commit();
+  log_flush();
+  ftrace_report(30);
+}
+
+/* Trace the calls from now on, log them to `file', and report at exit. */
+void init_ftrace(const char *file) {
+  ftrace_fp = fopen(file, "wb");
+  Assert(ftrace_fp, "Can not open '%s'", file);
+  uint32_t size = sizeof(FTraceRecord);
+  fwrite(FTRACE_MAGIC, strlen(FTRACE_MAGIC), 1, ftrace_fp);
+  fwrite(&size, sizeof(size), 1, ftrace_fp);
+
+  stat_table_init(&funcs, sizeof(Stat), offsetof(Stat, calls));
+  stat_table_init(&edges, sizeof(Stat), offsetof(Stat, calls));
+  start_instr = nr_guest_instr;
+  ftrace_on = true;
+  atexit(ftrace_exit);
+}
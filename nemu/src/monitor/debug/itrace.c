@@ -0,0 +1,127 @@
+#include "nemu.h"
+#include "monitor/itrace.h"
+#include "misc/io.h"
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* Each CPU traces into a ring of its own, allocated at its first
+ * instruction. A dump only uses open() and write(), so a crash can be
+ * dumped from the signal handler.
+ */
+static CPU_LOCAL ITraceRecord *ring;
+static CPU_LOCAL uint64_t nr_traced;
+/* the record of the instruction being executed, NULL between instructions */
+static CPU_LOCAL ITraceRecord *cur;
+
+/* where the ring is dumped by default */
+static const char *itrace_file = NULL;
+
+void itrace_begin(vaddr_t eip) {
+  if (ring == NULL) {
+    ring = calloc(NR_ITRACE, sizeof(*ring));
+    assert(ring != NULL);
+  }
+  cur = &ring[nr_traced & (NR_ITRACE - 1)];
+  cur->seq = nr_traced;
+  cur->eip = eip;
+  cur->len = 0;
+  cur->changed = 0;
+  /* compared with the gprs after the instruction */
+  int i;
+  for (i = 0; i < 8; i ++) {
+    cur->gpr[i] = cpu.gpr[i]._32;
+  }
+}
+
+/* Called by instr_fetch(). */
+void itrace_fetch(uint32_t instr, int len) {
+  /* e.g. the reference of differential testing is not traced */
+  if (cur == NULL) return;
+  int i;
+  for (i = 0; i < len && cur->len < ITRACE_MAX_LEN; i ++) {
+    cur->bytes[cur->len ++] = instr >> (i * 8);
+  }
+}
+
+/* The instruction just executed has `len' bytes, or as many as fetched
+ * if `len' is 0.
+ */
+void itrace_end(int len) {
+  if (len == 0) len = cur->len;
+  if (len > ITRACE_MAX_LEN) len = ITRACE_MAX_LEN;
+  /* the instructions replayed from the decode cache are not fetched */
+  while (cur->len < len) {
+    cur->bytes[cur->len] = vaddr_ifetch(cur->eip + cur->len, 1);
+    cur->len ++;
+  }
+  cur->len = len;
+
+  int i;
+  for (i = 0; i < 8; i ++) {
+    if (cpu.gpr[i]._32 != cur->gpr[i]) {
+      cur->changed |= 1 << i;
+      cur->gpr[i] = cpu.gpr[i]._32;
+    }
+  }
+  cur = NULL;
+  nr_traced ++;
+}
+
+/* Write the ring of this CPU to `fd', including the instruction being
+ * executed if any. Return the number of records, or -1 on failure.
+ */
+static int write_ring(int fd) {
+  uint64_t end = nr_traced + (cur != NULL);
+  uint32_t n = (ring == NULL ? 0 : end < NR_ITRACE ? end : NR_ITRACE);
+  uint32_t size = sizeof(ITraceRecord);
+  bool ok = write_all(fd, ITRACE_MAGIC, strlen(ITRACE_MAGIC)) &&
+    write_all(fd, &size, sizeof(size)) && write_all(fd, &n, sizeof(n));
+
+  uint32_t start = (end - n) & (NR_ITRACE - 1);
+  uint32_t first = (start + n <= NR_ITRACE ? n : NR_ITRACE - start);
+  ok = ok && write_all(fd, ring + start, first * size) &&
+    write_all(fd, ring, (n - first) * size);
+  return (ok ? n : -1);
+}
+
+/* Dump the ring of this CPU to `file', or to the file given by -i if it
+ * is NULL. Return false if there is no file or it can not be written.
+ */
+bool itrace_dump(const char *file) {
+  if (file == NULL) file = itrace_file;
+  if (file == NULL) return false;
+
+  int fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  int n = (fd < 0 ? -1 : write_ring(fd));
+  if (fd >= 0) close(fd);
+  if (n < 0) {
+    printf("Can not write the instruction trace to '%s'\n", file);
+    return false;
+  }
+  printf("The last %d instructions are dumped to %s\n", n, file);
+  return true;
+}
+
+static void crash_handler(int sig) {
+  int fd = (itrace_file == NULL ? -1 : open(itrace_file, O_WRONLY | O_CREAT | O_TRUNC, 0644));
+  if (fd >= 0) {
+    write_ring(fd);
+    close(fd);
+  }
+  signal(sig, SIG_DFL);
+  raise(sig);
+}
+
+/* Dump the ring to `file' on a panic or a crash, if it is not NULL. */
+void init_itrace(const char *file) {
+  itrace_file = file;
+  if (file == NULL) return;
+
+  int sigs[] = { SIGABRT, SIGSEGV, SIGBUS, SIGFPE, SIGILL };
+  int i;
+  for (i = 0; i < sizeof(sigs) / sizeof(sigs[0]); i ++) {
+    signal(sigs[i], crash_handler);
+  }
+}
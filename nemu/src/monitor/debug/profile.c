@@ -0,0 +1,193 @@
+#include "nemu.h"
+#include "monitor/profile.h"
+#include "monitor/symbol.h"
+#include "monitor/stat.h"
+#include "device/event.h"
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+/* Samples with the same stack are counted together, keyed by the stack. */
+typedef struct {
+  uint32_t depth;
+  vaddr_t pc[PROFILE_MAX_DEPTH + 1];   // eip, then the return addresses, then 0
+  uint64_t count;
+} Stack;
+
+static StatTable stacks;
+static uint64_t nr_sample = 0;
+
+static uint64_t interval;
+static int profile_event;
+static const char *folded_file = NULL;
+
+static void profile_sample() {
+  Stack key;
+  memset(&key, 0, sizeof(key));
+  vaddr_t *pc = key.pc;
+  int depth = 0;
+  pc[depth ++] = cpu.eip;
+
+  /* the frames are linked by ebp, and go up the stack */
+  vaddr_t fp = cpu.ebp;
+  while (depth <= PROFILE_MAX_DEPTH && fp != 0 && (fp & 3) == 0) {
+    uint32_t ret, next;
+    if (!vaddr_peek(fp + 4, 4, &ret) || !vaddr_peek(fp, 4, &next) || ret == 0) break;
+    pc[depth ++] = ret;
+    if (next <= fp) break;
+    fp = next;
+  }
+
+  key.depth = depth;
+  Stack *s = stat_entry(&stacks, stat_get(&stacks, &key));
+  s->count ++;
+  nr_sample ++;
+  event_schedule(profile_event, interval);
+}
+
+/* A return address is symbolized by the call before it. */
+static inline vaddr_t frame_addr(const Stack *s, int i) {
+  return (i == 0 ? s->pc[0] : s->pc[i] - 1);
+}
+
+typedef struct {
+  vaddr_t key;
+  uint64_t self, total;
+} FlatEntry;
+
+static int flat_key_cmp(const void *a, const void *b) {
+  vaddr_t x = ((const FlatEntry *)a)->key, y = ((const FlatEntry *)b)->key;
+  return (x > y) - (x < y);
+}
+
+static int flat_self_cmp(const void *a, const void *b) {
+  const FlatEntry *x = a, *y = b;
+  if (x->self != y->self) return (x->self < y->self) - (x->self > y->self);
+  return (x->total < y->total) - (x->total > y->total);
+}
+
+/* Print the `top' functions with the most samples in them (self), with
+ * the samples in them or the functions they call (total).
+ */
+void profile_report(int top) {
+  if (nr_sample == 0) {
+    printf("No samples yet\n");
+    return;
+  }
+
+  /* an entry for each frame, then merged by function */
+  FlatEntry *e = malloc(sizeof(*e) * (stacks.nr * (PROFILE_MAX_DEPTH + 1) + 1));
+  assert(e != NULL);
+  int n = 0;
+  uint32_t i;
+  char buf[SYMBOL_BUF_LEN];
+  for (i = 0; i < stacks.nr; i ++) {
+    Stack *s = stat_entry(&stacks, i);
+    int first = n, j;
+    for (j = 0; j < s->depth; j ++) {
+      vaddr_t key;
+      symbol_name(frame_addr(s, j), &key, buf);
+      /* a recursive function is counted once for each sample */
+      int k;
+      for (k = first; k < n && e[k].key != key; k ++);
+      if (k < n) continue;
+      e[n].key = key;
+      e[n].self = (j == 0 ? s->count : 0);
+      e[n].total = s->count;
+      n ++;
+    }
+  }
+
+  qsort(e, n, sizeof(*e), flat_key_cmp);
+  int m = 0, j;
+  for (j = 0; j < n; j ++) {
+    if (m > 0 && e[m - 1].key == e[j].key) {
+      e[m - 1].self += e[j].self;
+      e[m - 1].total += e[j].total;
+    }
+    else e[m ++] = e[j];
+  }
+  qsort(e, m, sizeof(*e), flat_self_cmp);
+
+  printf("%" PRIu64 " samples, one every %" PRIu64 " instructions\n", nr_sample, interval);
+  printf("  %%self     self  %%total    total  function\n");
+  for (j = 0; j < m && j < top; j ++) {
+    printf("%6.2f %8" PRIu64 " %6.2f %8" PRIu64 "  %s\n", ratio(e[j].self, nr_sample), e[j].self,
+        ratio(e[j].total, nr_sample), e[j].total, symbol_name(e[j].key, NULL, buf));
+  }
+  free(e);
+}
+
+typedef struct {
+  char *str;
+  uint64_t count;
+} Folded;
+
+static int folded_cmp(const void *a, const void *b) {
+  return strcmp(((const Folded *)a)->str, ((const Folded *)b)->str);
+}
+
+/* Write the stacks as "outer;...;inner count" lines, which is the input
+ * of flamegraph.pl. */
+bool profile_write_folded(const char *file) {
+  FILE *fp = fopen(file, "w");
+  if (fp == NULL) {
+    printf("Can not write the profile to '%s'\n", file);
+    return false;
+  }
+
+  /* different stacks of addresses may be the same stack of functions */
+  Folded *f = malloc(sizeof(*f) * (stacks.nr + 1));
+  assert(f != NULL);
+  int n = 0;
+  uint32_t i;
+  for (i = 0; i < stacks.nr; i ++) {
+    Stack *s = stat_entry(&stacks, i);
+    char *str = NULL;
+    size_t len = 0;
+    FILE *mem = open_memstream(&str, &len);
+    int j;
+    for (j = s->depth - 1; j >= 0; j --) {
+      char buf[SYMBOL_BUF_LEN];
+      fprintf(mem, "%s%s", symbol_name(frame_addr(s, j), NULL, buf), (j > 0 ? ";" : ""));
+    }
+    fclose(mem);
+    f[n].str = str;
+    f[n].count = s->count;
+    n ++;
+  }
+
+  qsort(f, n, sizeof(*f), folded_cmp);
+  int j;
+  for (j = 0; j < n; j ++) {
+    uint64_t count = f[j].count;
+    while (j + 1 < n && strcmp(f[j].str, f[j + 1].str) == 0) {
+      free(f[j].str);
+      count += f[++ j].count;
+    }
+    fprintf(fp, "%s %" PRIu64 "\n", f[j].str, count);
+    free(f[j].str);
+  }
+  free(f);
+  fclose(fp);
+  printf("The profile of %" PRIu64 " samples is written to %s\n", nr_sample, file);
+  return true;
+}
+
+static void profile_exit() {
+  profile_report(30);
+  if (folded_file != NULL) {
+    profile_write_folded(folded_file);
+  }
+}
+
+/* Sample every `n' instructions, and report at exit. The stacks are also
+ * written to `file' if it is not NULL. */
+void init_profile(uint64_t n, const char *file) {
+  interval = n;
+  folded_file = file;
+  stat_table_init(&stacks, sizeof(Stack), offsetof(Stack, count));
+  profile_event = add_event("profile", profile_sample);
+  event_schedule(profile_event, interval);
+  atexit(profile_exit);
+}
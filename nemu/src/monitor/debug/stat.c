@@ -0,0 +1,56 @@
+#include "nemu.h"
+#include "monitor/stat.h"
+#include <stdlib.h>
+
+void stat_table_init(StatTable *t, uint32_t entry_size, uint32_t key_size) {
+  assert(key_size > 0 && key_size % 4 == 0 && key_size <= entry_size);
+  memset(t, 0, sizeof(*t));
+  t->entry_size = entry_size;
+  t->key_size = key_size;
+}
+
+static uint32_t stat_hash(const StatTable *t, const void *key) {
+  const uint32_t *w = key;
+  uint32_t h = 2166136261u;
+  int i;
+  for (i = 0; i < t->key_size / 4; i ++) {
+    h = (h ^ w[i]) * 16777619u;
+  }
+  return h ^ (h >> 15);
+}
+
+static int* stat_slot(StatTable *t, const void *key) {
+  uint32_t i = stat_hash(t, key) & (t->nr_slot - 1);
+  while (t->index[i] != -1 && memcmp(stat_entry(t, t->index[i]), key, t->key_size) != 0) {
+    i = (i + 1) & (t->nr_slot - 1);
+  }
+  return &t->index[i];
+}
+
+int stat_get(StatTable *t, const void *key) {
+  if (t->nr * 2 >= t->nr_slot) {
+    t->nr_slot = (t->nr_slot == 0 ? 1024 : t->nr_slot * 2);
+    free(t->index);
+    t->index = malloc(sizeof(*t->index) * t->nr_slot);
+    assert(t->index != NULL);
+    memset(t->index, -1, sizeof(*t->index) * t->nr_slot);
+    uint32_t i;
+    for (i = 0; i < t->nr; i ++) {
+      *stat_slot(t, stat_entry(t, i)) = i;
+    }
+  }
+
+  int *slot = stat_slot(t, key);
+  if (*slot == -1) {
+    if (t->nr == t->max) {
+      t->max = (t->max == 0 ? 1024 : t->max * 2);
+      t->entries = realloc(t->entries, (size_t)t->entry_size * t->max);
+      assert(t->entries != NULL);
+    }
+    void *e = stat_entry(t, t->nr);
+    memset(e, 0, t->entry_size);
+    memcpy(e, key, t->key_size);
+    *slot = t->nr ++;
+  }
+  return *slot;
+}
@@ -0,0 +1,105 @@
+#include "nemu.h"
+#include "monitor/symbol.h"
+#include <elf.h>
+#include <stdlib.h>
+
+typedef struct {
+  vaddr_t addr;
+  uint32_t size;   // 0 if unknown, then it ends at the next symbol
+  char *name;
+} Symbol;
+
+/* sorted by address */
+static Symbol *syms = NULL;
+static int nr_sym = 0, max_sym = 0;
+
+static int sym_cmp(const void *a, const void *b) {
+  vaddr_t x = ((const Symbol *)a)->addr, y = ((const Symbol *)b)->addr;
+  return (x > y) - (x < y);
+}
+
+static void add_symbol(vaddr_t addr, uint32_t size, const char *name) {
+  if (nr_sym == max_sym) {
+    max_sym = (max_sym == 0 ? 1024 : max_sym * 2);
+    syms = realloc(syms, sizeof(*syms) * max_sym);
+    assert(syms != NULL);
+  }
+  syms[nr_sym].addr = addr;
+  syms[nr_sym].size = size;
+  syms[nr_sym].name = strdup(name);
+  nr_sym ++;
+}
+
+/* Load the function symbols of an ELF32 file. Return false if it can not
+ * be read. */
+bool symbol_load(const char *file) {
+  FILE *fp = fopen(file, "rb");
+  if (fp == NULL) return false;
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  uint8_t *buf = malloc(size);
+  assert(buf != NULL);
+  bool ok = (fread(buf, size, 1, fp) == 1);
+  fclose(fp);
+
+  Elf32_Ehdr *eh = (void *)buf;
+  ok = ok && size >= sizeof(*eh) && memcmp(eh->e_ident, ELFMAG, SELFMAG) == 0 &&
+    eh->e_ident[EI_CLASS] == ELFCLASS32 &&
+    eh->e_shoff + (uint64_t)eh->e_shnum * sizeof(Elf32_Shdr) <= size;
+  if (!ok) {
+    free(buf);
+    return false;
+  }
+
+  int n = nr_sym;
+  Elf32_Shdr *sh = (void *)(buf + eh->e_shoff);
+  int i;
+  for (i = 0; i < eh->e_shnum; i ++) {
+    if (sh[i].sh_type != SHT_SYMTAB || sh[i].sh_link >= eh->e_shnum) continue;
+    Elf32_Shdr *strtab = &sh[sh[i].sh_link];
+    if (sh[i].sh_offset + (uint64_t)sh[i].sh_size > size ||
+        strtab->sh_offset + (uint64_t)strtab->sh_size > size) continue;
+
+    Elf32_Sym *sym = (void *)(buf + sh[i].sh_offset);
+    int j;
+    for (j = 0; j < sh[i].sh_size / sizeof(*sym); j ++) {
+      if (ELF32_ST_TYPE(sym[j].st_info) != STT_FUNC || sym[j].st_value == 0 ||
+          sym[j].st_name >= strtab->sh_size) continue;
+      const char *name = (const char *)buf + strtab->sh_offset + sym[j].st_name;
+      if (memchr(name, '\0', strtab->sh_size - sym[j].st_name) == NULL) continue;
+      add_symbol(sym[j].st_value, sym[j].st_size, name);
+    }
+  }
+  free(buf);
+
+  qsort(syms, nr_sym, sizeof(*syms), sym_cmp);
+  Log("Loaded %d function symbols from %s", nr_sym - n, file);
+  return true;
+}
+
+const char* symbol_find(vaddr_t addr, vaddr_t *start) {
+  /* the last symbol at or before addr */
+  int l = 0, r = nr_sym;
+  while (l < r) {
+    int m = l + (r - l) / 2;
+    if (syms[m].addr <= addr) l = m + 1;
+    else r = m;
+  }
+  if (l == 0) return NULL;
+
+  Symbol *s = &syms[l - 1];
+  if (s->size != 0 ? addr - s->addr >= s->size : l == nr_sym) return NULL;
+  if (start != NULL) *start = s->addr;
+  return s->name;
+}
+
+const char* symbol_name(vaddr_t addr, vaddr_t *start, char *buf) {
+  const char *name = symbol_find(addr, start);
+  if (name == NULL) {
+    if (start != NULL) *start = addr;
+    snprintf(buf, SYMBOL_BUF_LEN, "0x%08x", addr);
+    name = buf;
+  }
+  return name;
+}
@@ -1,13 +1,23 @@
 #include "monitor/monitor.h"
 #include "monitor/expr.h"
 #include "monitor/watchpoint.h"
+#include "monitor/snapshot.h"
+#include "monitor/itrace.h"
+#include "monitor/profile.h"
+#include "monitor/ftrace.h"
+#include "cpu/opstat.h"
+#include "cpu/branch-pred.h"
 #include "nemu.h"
 
 #include <stdlib.h>
+#include <ctype.h>
 #include <readline/readline.h>
 #include <readline/history.h>
 
 void cpu_exec(uint64_t);
+void decode_cache_stat(void);
+void block_stat(void);
+void tlb_stat(void);
 
 /* We use the `readline' library to provide more flexibility to read from stdin. */
 char *rl_gets()
@@ -101,6 +111,13 @@ static int cmd_info(char *args)
     print_wp();
     return 0;
   }
+  if (s == 's')
+  {
+    decode_cache_stat();
+    block_stat();
+    tlb_stat();
+    return 0;
+  }
   printf("args error in cmd_info\n");
   return 0;
 }
@@ -121,6 +138,11 @@ static int cmd_x(char *args)
 
   bool success = false;
   addr = expr(s, &success);
+  if (success == false)
+  {
+    printf("error in expr()\n");
+    return 0;
+  }
 
   printf("Memory:");
   for (int i = 0; i < nLen * 4; i += 4)
@@ -149,7 +171,7 @@ static int cmd_p(char *args)
   int res = expr(args, &success);
   if (success == false)
   {
-    printf("error in expr()");
+    printf("error in expr()\n");
     return 0;
   }
   printf("The value of expr is:%d\n", res);
@@ -163,6 +185,21 @@ static int cmd_w(char *args)
     printf("args error in cmd_w\n");
     return 0;
   }
+  if (args[0] == '-')
+  {
+    /* -r, -w or -a, with the size in bytes, 4 by default, e.g. w -w1 ADDR */
+    const char *types = "rwa";
+    char *p = strchr(types, args[1]);
+    char *end = args + 2;
+    uint32_t len = (isdigit(*end) ? strtoul(end, &end, 0) : 4);
+    if (args[1] == '\0' || p == NULL || *end != ' ')
+    {
+      printf("args error in cmd_w\n");
+      return 0;
+    }
+    new_mem_wp(WP_READ + (p - types), len, end + 1);
+    return 0;
+  }
   new_wp(args);
   return 0;
 }
@@ -188,6 +225,103 @@ static int cmd_d(char *args)
   return 0;
 }
 
+static int cmd_save(char *args)
+{
+  bool incremental = false;
+  char *file = strtok(NULL, " ");
+  if (file != NULL && strcmp(file, "-i") == 0)
+  {
+    incremental = true;
+    file = strtok(NULL, " ");
+  }
+  if (file == NULL)
+  {
+    printf("args error in cmd_save\n");
+    return 0;
+  }
+  if (nemu_state == NEMU_END)
+  {
+    printf("Program execution has ended, no snapshot is saved\n");
+    return 0;
+  }
+  snapshot_save(file, incremental);
+  return 0;
+}
+
+static int cmd_load(char *args)
+{
+  char *file = strtok(NULL, " ");
+  if (file == NULL)
+  {
+    printf("args error in cmd_load\n");
+    return 0;
+  }
+  snapshot_load(file);
+  return 0;
+}
+
+static int cmd_profile(char *args)
+{
+  char *file = strtok(NULL, " ");
+  profile_report(30);
+  if (file != NULL)
+  {
+    profile_write_folded(file);
+  }
+  return 0;
+}
+
+static int cmd_ftrace(char *args)
+{
+  char *arg = strtok(NULL, " ");
+  if (!ftrace_on)
+  {
+    printf("Calls are not traced, run NEMU with -F\n");
+    return 0;
+  }
+  ftrace_report(arg == NULL ? 30 : atoi(arg));
+  return 0;
+}
+
+#ifdef CACHE_SIM
+static int cmd_cache(char *args)
+{
+  char *arg = strtok(NULL, " ");
+  cache_report(arg == NULL ? 30 : atoi(arg));
+  return 0;
+}
+#endif
+
+#ifdef BRANCH_SIM
+static int cmd_branch(char *args)
+{
+  char *arg = strtok(NULL, " ");
+  bpred_report(arg == NULL ? 30 : atoi(arg));
+  return 0;
+}
+#endif
+
+#ifdef OPCODE_STAT
+static int cmd_opstat(char *args)
+{
+  char *arg = strtok(NULL, " ");
+  opstat_report(arg == NULL ? 30 : atoi(arg));
+  return 0;
+}
+#endif
+
+#ifdef ITRACE
+static int cmd_itrace(char *args)
+{
+  char *file = strtok(NULL, " ");
+  if (!itrace_dump(file) && file == NULL)
+  {
+    printf("args error in cmd_itrace, no file is given by -i\n");
+  }
+  return 0;
+}
+#endif
+
 static struct
 {
   char *name;
@@ -198,11 +332,27 @@ static struct
     {"c", "Continue the execution of the program", cmd_c},
     {"q", "Exit NEMU", cmd_q},
     {"si", "args: [N]; execute [N] instructions step by step", cmd_si},
-    {"info", "args: r/w; print information about register or watchpoint", cmd_info},
+    {"info", "args: r/w/s; print information about register, watchpoint or statistics", cmd_info},
     {"x", "x [N] [EXPR]; scan the memory", cmd_x},
     {"p", "expr", cmd_p},
-    {"w", "set the watchpoint", cmd_w},
+    {"w", "args: [-r|-w|-a[SIZE]] EXPR; set the watchpoint, or watch the reads, writes or both of SIZE bytes at EXPR", cmd_w},
     {"d", "delete the watchpoint", cmd_d},
+    {"save", "args: [-i] FILE; save a snapshot, with -i only the pages written since the last one", cmd_save},
+    {"load", "args: FILE; load a snapshot", cmd_load},
+    {"profile", "args: [FILE]; print the functions sampled most with -P, and write the stacks to FILE for flame graphs", cmd_profile},
+    {"ftrace", "args: [N]; print the N functions with the most instructions in them, and the calls, with -F", cmd_ftrace},
+#ifdef CACHE_SIM
+    {"cache", "args: [N]; print the statistics of the caches, and the N functions with the most misses", cmd_cache},
+#endif
+#ifdef BRANCH_SIM
+    {"branch", "args: [N]; print the misprediction rates, and the N branches mispredicted most", cmd_branch},
+#endif
+#ifdef OPCODE_STAT
+    {"opstat", "args: [N]; print the N opcodes executed most, with their host cycles", cmd_opstat},
+#endif
+#ifdef ITRACE
+    {"itrace", "args: [FILE]; dump the last instructions executed, to the file given by -i by default", cmd_itrace},
+#endif
 
     /* TODO: Add more commands */
 
@@ -1,15 +1,23 @@
+#include "nemu.h"
+#include "monitor/monitor.h"
 #include "monitor/watchpoint.h"
 #include "monitor/expr.h"
+#include "monitor/diff-test.h"
+#include <stdlib.h>
 
+/* the pool grows by NR_WP watchpoints at a time */
 #define NR_WP 32
 
-static WP wp_pool[NR_WP];
 static WP *head, *free_;
 static int used_next;
 static WP *wptemp;
 
-void init_wp_pool()
+int nr_mem_wp = 0;
+
+static void grow_wp_pool()
 {
+  WP *wp_pool = calloc(NR_WP, sizeof(WP));
+  assert(wp_pool != NULL);
   int i;
   for (i = 0; i < NR_WP; i++)
   {
@@ -18,21 +26,25 @@ void init_wp_pool()
     wp_pool[i].oldValue = 0;
     wp_pool[i].hitNum = 0;
   }
-  wp_pool[NR_WP - 1].next = NULL;
+  wp_pool[NR_WP - 1].next = free_;
+  free_ = wp_pool;
+}
 
+void init_wp_pool()
+{
   head = NULL;
-  free_ = wp_pool;
+  free_ = NULL;
+  grow_wp_pool();
   used_next = 0;
 }
 
 /* TODO: Implement the functionality of watchpoint */
 
-bool new_wp(char *args)
+static WP *alloc_wp(int type, char *args)
 {
   if (free_ == NULL)
   {
-    printf("No more watchpoint in wp_pool[]\n");
-    assert(0);
+    grow_wp_pool();
   }
   WP *result = free_;
   free_ = free_->next;
@@ -40,16 +52,9 @@ bool new_wp(char *args)
   result->NO = used_next;
   used_next++;
   result->next = NULL;
-  strncpy(result->e, args, strlen(args));
-  *(result->e + strlen(args)) = '\0';
+  result->e = strdup(args);
   result->hitNum = 0;
-  bool success;
-  result->oldValue = expr(result->e, &success);
-  if (success == false)
-  {
-    printf("error in new_wp(): expression fault\n");
-    return false;
-  }
+  result->type = type;
 
   wptemp = head;
   if (wptemp == NULL)
@@ -64,11 +69,58 @@ bool new_wp(char *args)
     }
     wptemp->next = result;
   }
+  return result;
+}
+
+bool new_wp(char *args)
+{
+  /* parse the expression once, it is evaluated after each instruction */
+  CompiledExpr ce;
+  uint32_t val;
+  if (!expr_compile(args, &ce) || !expr_eval(&ce, &val))
+  {
+    printf("error in new_wp(): expression fault\n");
+    return false;
+  }
+
+  WP *result = alloc_wp(WP_EXPR, args);
+  result->ce = ce;
+  result->oldValue = val;
 
   printf("Success: set watchpoint %d, expr = %s, oldValue = %d\n", result->NO, result->e, result->oldValue);
   return true;
 }
 
+static const char *type_name[] = { "expr", "read", "write", "access" };
+
+/* Watch `len' bytes at the address given by `args', which is evaluated
+ * once. */
+bool new_mem_wp(int type, uint32_t len, char *args)
+{
+  bool success;
+  vaddr_t addr = expr(args, &success);
+  if (success == false)
+  {
+    printf("error in new_mem_wp(): expression fault\n");
+    return false;
+  }
+  if (len == 0 || addr + len - 1 < addr)
+  {
+    printf("error in new_mem_wp(): bad range\n");
+    return false;
+  }
+
+  WP *result = alloc_wp(type, args);
+  result->addr = addr;
+  result->len = len;
+  nr_mem_wp++;
+  /* the pages watched leave the host TLBs, and stay out of them */
+  host_tlb_flush_all();
+
+  printf("Success: set watchpoint %d, %s %u bytes at 0x%08x\n", result->NO, type_name[type], len, addr);
+  return true;
+}
+
 bool free_wp(int num)
 {
   WP *thewp = NULL;
@@ -100,6 +152,12 @@ bool free_wp(int num)
 
   if (thewp != NULL)
   {
+    if (thewp->type != WP_EXPR)
+    {
+      nr_mem_wp--;
+    }
+    free(thewp->e);
+    thewp->e = NULL;
     thewp->next = free_;
     free_ = thewp;
     return true;
@@ -119,15 +177,22 @@ void print_wp()
   wptemp = head;
   while (wptemp != NULL)
   {
-    printf("%d  \t%s  \t%d\n", wptemp->NO, wptemp->e, wptemp->hitNum);
+    if (wptemp->type == WP_EXPR)
+    {
+      printf("%d  \t%s  \t%d\n", wptemp->NO, wptemp->e, wptemp->hitNum);
+    }
+    else
+    {
+      printf("%d  \t%s %u bytes at %s (0x%08x)  \t%d\n", wptemp->NO, type_name[wptemp->type],
+          wptemp->len, wptemp->e, wptemp->addr, wptemp->hitNum);
+    }
     wptemp = wptemp->next;
   }
 }
 
 bool watch_wp()
 {
-  bool success;
-  int result;
+  uint32_t result;
   if (head == NULL)
   {
     return true;
@@ -135,7 +200,17 @@ bool watch_wp()
   wptemp = head;
   while (wptemp != NULL)
   {
-    result = expr(wptemp->e, &success);
+    if (wptemp->type != WP_EXPR)
+    {
+      wptemp = wptemp->next;
+      continue;
+    }
+    if (!expr_eval(&wptemp->ce, &result))
+    {
+      /* stop, as the expression can not be watched any more */
+      printf("Hardware watchpoint %d: %s can not be evaluated\n\n", wptemp->NO, wptemp->e);
+      return false;
+    }
     if (result != wptemp->oldValue)
     {
       wptemp->hitNum++;
@@ -147,4 +222,69 @@ bool watch_wp()
     wptemp = wptemp->next;
   }
   return true;
-}
\ No newline at end of file
+}
+
+static inline bool overlap(const WP *wp, vaddr_t addr, uint32_t len)
+{
+  return addr <= wp->addr + wp->len - 1 && wp->addr <= addr + len - 1;
+}
+
+/* Called before a page enters the host TLBs. */
+bool mem_wp_page(vaddr_t addr)
+{
+  WP *wp;
+  for (wp = head; wp != NULL; wp = wp->next)
+  {
+    if (wp->type != WP_EXPR && overlap(wp, addr & ~0xfff, 0x1000))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Called by the slow path before the guest reads or writes `len' bytes
+ * at `addr'. NEMU stops after the instruction. */
+void mem_wp_check(vaddr_t addr, int len, int type, uint32_t data)
+{
+  /* the monitor, e.g. `x', and the reference of differential testing
+   * do not hit watchpoints */
+  if (nemu_state != NEMU_RUNNING) return;
+#ifdef DIFF_TEST
+  if (difftest_is_ref) return;
+#endif
+  static CPU_LOCAL bool checking = false;
+  if (checking) return;
+  checking = true;
+
+  WP *wp;
+  for (wp = head; wp != NULL; wp = wp->next)
+  {
+    if (wp->type == WP_EXPR || !overlap(wp, addr, len))
+    {
+      continue;
+    }
+    if ((type == MEM_READ && wp->type == WP_WRITE) || (type == MEM_WRITE && wp->type == WP_READ))
+    {
+      continue;
+    }
+    wp->hitNum++;
+    printf("Hardware watchpoint %d: %s %d bytes at 0x%08x, eip = 0x%08x\n",
+        wp->NO, (type == MEM_READ ? "read" : "write"), len, addr, cpu.eip);
+    /* the old value is peeked, as reading a device has side effects */
+    uint32_t old;
+    bool has_old = vaddr_peek(addr, len, &old);
+    if (type == MEM_READ)
+    {
+      if (has_old) printf("Value: 0x%08x\n", old);
+      printf("\n");
+    }
+    else
+    {
+      if (has_old) printf("Old value: 0x%08x\n", old);
+      printf("New value: 0x%08x\n\n", data);
+    }
+    nemu_state = NEMU_STOP;
+  }
+  checking = false;
+}
@@ -0,0 +1,186 @@
+#include "nemu.h"
+#include "monitor/monitor.h"
+#include "monitor/diff-test.h"
+#include "monitor/itrace.h"
+#include "monitor/ftrace.h"
+#include "device/event.h"
+#include "misc/io.h"
+#include <inttypes.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+/* With checkpoints, NEMU is only checked every so many instructions, but
+ * the memory written in between is checked too. At each check which
+ * passes, NEMU forks a child, which keeps the state there and waits. If
+ * the next check fails, the child finds the first instruction which
+ * differs:
+ * 1. it re-runs from its state, checking every step, to find the first
+ *    step which differs;
+ * 2. it re-runs to the start of that step, then executes one
+ *    instruction at a time, checking each.
+ * Each re-run is a process forked from the child, with a reference of
+ * its own. NEMU sends the child the values it has read from devices
+ * since the checkpoint, and the re-runs read them instead of the devices.
+ * Device writes are dropped.
+ */
+
+/* the child at the last checkpoint, and the pipe to it */
+static pid_t ckpt_pid = -1;
+static int ckpt_fd = -1;
+static uint64_t ckpt_instr;
+
+/* the device reads since the last checkpoint */
+static uint32_t *inputs = NULL;
+static uint32_t nr_input = 0, max_input = 0;
+static uint32_t next_input = 0;
+
+/* set in the child, and the re-runs */
+bool checkpoint_rerun = false;
+
+typedef struct {
+  bool failed;
+  uint64_t instr;
+  uint32_t n;
+  vaddr_t eip;
+} RerunResult;
+
+void checkpoint_log_input(uint32_t data) {
+  if (nr_input == max_input) {
+    max_input = (max_input == 0 ? 1024 : max_input * 2);
+    inputs = realloc(inputs, sizeof(*inputs) * max_input);
+    assert(inputs != NULL);
+  }
+  inputs[nr_input ++] = data;
+}
+
+/* Called instead of reading a device in a re-run. */
+bool checkpoint_replay_read(uint32_t *data) {
+  if (!checkpoint_rerun) return false;
+  /* a re-run which goes astray may read more */
+  *data = (next_input < nr_input ? inputs[next_input ++] : 0);
+  return true;
+}
+
+/* Re-run in a process forked from here, so this state is kept for the
+ * next one. The output of a quiet re-run is dropped. Return false if the
+ * re-run crashes.
+ */
+static bool rerun(uint64_t end, uint64_t single_from, bool quiet, RerunResult *res) {
+  int fd[2];
+  int ret = pipe(fd);
+  Assert(ret == 0, "Can not create a pipe");
+  fflush(stdout);
+  pid_t pid = fork();
+  Assert(pid >= 0, "Can not fork a re-run");
+  if (pid == 0) {
+    close(fd[0]);
+#ifdef ITRACE
+    /* keep the trace of NEMU */
+    init_itrace(NULL);
+#endif
+    ftrace_on = false;
+    if (quiet) {
+      int null_fd = open("/dev/null", O_WRONLY);
+      if (null_fd >= 0) dup2(null_fd, STDOUT_FILENO);
+    }
+    RerunResult r;
+    r.failed = difftest_rerun(end, single_from, &r.instr, &r.n, &r.eip);
+    fflush(stdout);
+    write_all(fd[1], &r, sizeof(r));
+    _exit(0);
+  }
+
+  close(fd[1]);
+  bool ok = read_all(fd[0], res, sizeof(*res));
+  close(fd[0]);
+  waitpid(pid, NULL, 0);
+  return ok;
+}
+
+static void bisect(uint64_t end) {
+  RerunResult r;
+  if (!rerun(end, end, true, &r)) {
+    printf("The re-run from the checkpoint crashed\n");
+    return;
+  }
+  if (!r.failed) {
+    printf("The divergence does not show up when every step is checked\n");
+    return;
+  }
+  printf("The first step which differs has %u instructions from eip = 0x%08x\n", r.n, r.eip);
+
+  RerunResult s;
+  if (!rerun(r.instr, r.instr - r.n, false, &s)) {
+    printf("The re-run from the checkpoint crashed\n");
+  }
+  else if (!s.failed) {
+    printf("Each instruction of the step matches when executed one at a time, "
+        "so the step only differs as a whole\n");
+  }
+  else {
+    printf("The first instruction which differs is at eip = 0x%08x, "
+        "after %" PRIu64 " instructions\n", s.eip, s.instr);
+  }
+}
+
+/* The child waits here until NEMU sends the end of a failed check, or
+ * goes on, closing the pipe. */
+static void checkpoint_wait(int fd) {
+  uint64_t end;
+  if (!read_all(fd, &end, sizeof(end)) || !read_all(fd, &nr_input, sizeof(nr_input))) {
+    _exit(0);
+  }
+  inputs = realloc(inputs, sizeof(*inputs) * (nr_input + 1));
+  assert(inputs != NULL);
+  if (!read_all(fd, inputs, sizeof(*inputs) * nr_input)) {
+    _exit(0);
+  }
+  close(fd);
+
+  checkpoint_rerun = true;
+  bisect(end);
+  fflush(stdout);
+  _exit(0);
+}
+
+/* Keep the current state, which matches the reference, at a new
+ * checkpoint, in place of the last one. */
+void checkpoint_take() {
+  if (ckpt_pid > 0) {
+    /* the child exits when the pipe is closed */
+    close(ckpt_fd);
+    waitpid(ckpt_pid, NULL, 0);
+  }
+  nr_input = 0;
+  ckpt_instr = nr_guest_instr;
+
+  int fd[2];
+  int ret = pipe(fd);
+  Assert(ret == 0, "Can not create a pipe");
+  fflush(stdout);
+  pid_t pid = fork();
+  Assert(pid >= 0, "Can not fork a checkpoint");
+  if (pid == 0) {
+    close(fd[1]);
+    checkpoint_wait(fd[0]);
+  }
+  close(fd[0]);
+  ckpt_pid = pid;
+  ckpt_fd = fd[1];
+}
+
+/* A check after `end' instructions has failed, find the first
+ * instruction which differs since the last checkpoint. */
+void checkpoint_bisect(uint64_t end) {
+  if (ckpt_pid <= 0) return;
+  printf("Re-running from the checkpoint after %" PRIu64 " instructions\n", ckpt_instr);
+  fflush(stdout);
+  write_all(ckpt_fd, &end, sizeof(end));
+  write_all(ckpt_fd, &nr_input, sizeof(nr_input));
+  write_all(ckpt_fd, inputs, sizeof(*inputs) * nr_input);
+  close(ckpt_fd);
+  waitpid(ckpt_pid, NULL, 0);
+  ckpt_pid = -1;
+}
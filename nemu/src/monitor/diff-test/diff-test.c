@@ -1,202 +1,215 @@
 #include "nemu.h"
 #include "monitor/monitor.h"
-#include <unistd.h>
-#include <sys/prctl.h>
-#include <signal.h>
-
-#include "protocol.h"
-#include <stdlib.h>
-
-bool gdb_connect_qemu(void);
-bool gdb_memcpy_to_qemu(uint32_t, void *, int);
-bool gdb_getregs(union gdb_regs *);
-bool gdb_setregs(union gdb_regs *);
-bool gdb_si(void);
-void gdb_exit(void);
-
-static bool is_skip_qemu;
-static bool is_skip_nemu;
-
-void diff_test_skip_qemu() { is_skip_qemu = true; }
-void diff_test_skip_nemu() { is_skip_nemu = true; }
-
-#define regcpy_from_nemu(regs) \
-  do { \
-    regs.eax = cpu.eax; \
-    regs.ecx = cpu.ecx; \
-    regs.edx = cpu.edx; \
-    regs.ebx = cpu.ebx; \
-    regs.esp = cpu.esp; \
-    regs.ebp = cpu.ebp; \
-    regs.esi = cpu.esi; \
-    regs.edi = cpu.edi; \
-    regs.eip = cpu.eip; \
-  } while (0)
-
-static uint8_t mbr[] = {
-  // start16:
-  0xfa,                           // cli
-  0x31, 0xc0,                     // xorw   %ax,%ax
-  0x8e, 0xd8,                     // movw   %ax,%ds
-  0x8e, 0xc0,                     // movw   %ax,%es
-  0x8e, 0xd0,                     // movw   %ax,%ss
-  0x0f, 0x01, 0x16, 0x44, 0x7c,   // lgdt   gdtdesc
-  0x0f, 0x20, 0xc0,               // movl   %cr0,%eax
-  0x66, 0x83, 0xc8, 0x01,         // orl    $CR0_PE,%eax
-  0x0f, 0x22, 0xc0,               // movl   %eax,%cr0
-  0xea, 0x1d, 0x7c, 0x08, 0x00,   // ljmp   $GDT_ENTRY(1),$start32
-
-  // start32:
-  0x66, 0xb8, 0x10, 0x00,         // movw   $0x10,%ax
-  0x8e, 0xd8,                     // movw   %ax, %ds
-  0x8e, 0xc0,                     // movw   %ax, %es
-  0x8e, 0xd0,                     // movw   %ax, %ss
-  0xeb, 0xfe,                     // jmp    7c27
-  0x8d, 0x76, 0x00,               // lea    0x0(%esi),%esi
-
-  // GDT
-  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-  0xff, 0xff, 0x00, 0x00, 0x00, 0x9a, 0xcf, 0x00,
-  0xff, 0xff, 0x00, 0x00, 0x00, 0x92, 0xcf, 0x00,
-
-  // GDT descriptor
-  0x17, 0x00, 0x2c, 0x7c, 0x00, 0x00
-};
-
-void init_difftest(void) {
-  int ppid_before_fork = getpid();
-  int pid = fork();
-  if (pid == -1) {
-    perror("fork");
-    panic("fork error");
-  }
-  else if (pid == 0) {
-    // child
-
-    // install a parent death signal in the chlid
-    int r = prctl(PR_SET_PDEATHSIG, SIGTERM);
-    if (r == -1) {
-      perror("prctl error");
-      panic("prctl");
+#include "monitor/diff-test.h"
+#include "device/event.h"
+#include <inttypes.h>
+
+void cpu_exec(uint64_t);
+
+extern DiffTestBackend difftest_ref, difftest_qemu;
+
+static DiffTestBackend *backends[] = { &difftest_ref, &difftest_qemu };
+
+#define NR_BACKEND (sizeof(backends) / sizeof(backends[0]))
+
+static DiffTestBackend *backend = NULL;
+
+/* the step being taken by NEMU, which may gather several calls of
+ * difftest_step() between checkpoints */
+static DiffStep step = { .intr = -1 };
+
+/* set by the backend, maybe from another thread */
+static volatile bool is_failed = false;
+/* the first step which differs */
+static uint64_t fail_instr;
+static uint32_t fail_n;
+static vaddr_t fail_eip;
+
+/* check every step if 0, otherwise at the first step after every
+ * `ckpt_interval' instructions, see checkpoint.c */
+static uint64_t ckpt_interval = 0;
+static uint64_t next_ckpt;
+/* some steps are sent without a check since the last one */
+static bool unchecked = false;
+/* check the memory written at every check */
+static bool check_mem = false;
+/* execute one instruction at a time */
+static bool single_step = false;
+
+void init_difftest(const char *name, uint64_t interval) {
+  int i;
+  for (i = 0; i < NR_BACKEND; i ++) {
+    if (strcmp(backends[i]->name, name) == 0) {
+      backend = backends[i];
+      break;
     }
+  }
+  Assert(backend != NULL, "Unknown backend '%s' of differential testing", name);
+  Assert(interval == 0 || backend->restart != NULL,
+      "The %s backend of differential testing does not support checkpoints", name);
+  ckpt_interval = interval;
+  check_mem = (interval > 0);
+
+  backend->init();
+  Log("Differential testing with the %s backend", name);
+  if (interval > 0) {
+    Log("Checking every %" PRIu64 " instructions with checkpoints", interval);
+  }
+}
 
-    if (getppid() != ppid_before_fork) {
-      panic("parent has died!");
-    }
+/* Called after NEMU is initialized. */
+void difftest_start() {
+  if (ckpt_interval == 0) return;
+  /* both sides start to track the pages written from here */
+  pmem_written_hash();
+  checkpoint_take();
+  next_ckpt = nr_guest_instr + ckpt_interval;
+}
 
-    close(STDIN_FILENO);
-    execlp("qemu-system-i386", "qemu-system-i386", "-S", "-s", "-nographic", NULL);
-    perror("exec");
-    panic("exec error");
+/* Start over from the current state in a process forked at a checkpoint,
+ * and check every step up to `end' instructions. The steps after
+ * `single_from' instructions are single instructions. Return whether
+ * some step differs, together with the first one.
+ */
+bool difftest_rerun(uint64_t end, uint64_t single_from,
+    uint64_t *instr, uint32_t *n, vaddr_t *eip) {
+  is_failed = false;
+  step = (DiffStep) { .intr = -1 };
+  unchecked = false;
+  ckpt_interval = 0;
+  check_mem = true;
+  single_step = false;
+  pmem_written_hash();
+  backend->restart();
+
+  nemu_state = NEMU_STOP;
+  if (single_from > nr_guest_instr) {
+    cpu_exec(single_from - nr_guest_instr);
+  }
+  single_step = true;
+  if (!is_failed && end > nr_guest_instr) {
+    cpu_exec(end - nr_guest_instr);
   }
-  else {
-    // father
 
-    gdb_connect_qemu();
-    Log("Connect to QEMU successfully");
+  *instr = fail_instr;
+  *n = fail_n;
+  *eip = fail_eip;
+  return is_failed;
+}
 
-    atexit(gdb_exit);
+void difftest_memcpy(paddr_t addr, void *src, size_t n) {
+  backend->memcpy(addr, src, n);
+}
 
-    // put the MBR code to QEMU to enable protected mode
-    bool ok = gdb_memcpy_to_qemu(0x7c00, mbr, sizeof(mbr));
-    assert(ok == 1);
+void difftest_setregs() {
+  backend->setregs();
+}
 
-    union gdb_regs r;
-    gdb_getregs(&r);
+/* The step of n instructions from `eip', ending after `instr'
+ * instructions, differs. */
+void difftest_fail(uint64_t instr, uint32_t n, vaddr_t eip) {
+  if (is_failed) return;
+  fail_instr = instr;
+  fail_n = n;
+  fail_eip = eip;
+  is_failed = true;
+}
 
-    // set cs:eip to 0000:7c00
-    r.eip = 0x7c00;
-    r.cs = 0x0000;
-    ok = gdb_setregs(&r);
-    assert(ok == 1);
+void difftest_skip_ref() { step.skip_ref = true; }
+void difftest_skip_dut() { step.skip_dut = true; }
 
-    // execute enough instructions to enter protected mode
-    int i;
-    for (i = 0; i < 20; i ++) {
-      gdb_si();
-    }
-  }
+void difftest_intr(uint8_t NO) {
+  step.intr = NO;
 }
 
-void init_qemu_reg() {
-  union gdb_regs r;
-  gdb_getregs(&r);
-  regcpy_from_nemu(r);
-  bool ok = gdb_setregs(&r);
-  assert(ok == 1);
+void difftest_device_read(uint32_t data) {
+  if (backend->device_read != NULL) backend->device_read(data);
+  else step.skip_ref = true;
+  if (ckpt_interval > 0) checkpoint_log_input(data);
 }
 
-void difftest_step(uint32_t eip) {
-  union gdb_regs r;
-  bool diff = false;
+void difftest_device_write() {
+  if (backend->device_read == NULL) step.skip_ref = true;
+}
 
-  if (is_skip_nemu) {
-    is_skip_nemu = false;
-    return;
+/* Called instead of reading a device. Return false if the device should
+ * be read. */
+bool difftest_replay_read(uint32_t *data) {
+  if (difftest_is_ref) {
+    *data = difftest_ref_device_read();
+    return true;
   }
-
-  if (is_skip_qemu) {
-    // to skip the checking of an instruction, just copy the reg state to qemu
-    gdb_getregs(&r);
-    regcpy_from_nemu(r);
-    gdb_setregs(&r);
-    is_skip_qemu = false;
-    return;
+  if (checkpoint_replay_read(data)) {
+    /* the reference gets it as usual */
+    difftest_device_read(*data);
+    return true;
   }
+  return false;
+}
 
-  gdb_si();
-  gdb_getregs(&r);
+/* Called instead of writing a device. Return false if the device should
+ * be written. */
+bool difftest_replay_write() {
+  return difftest_is_ref || checkpoint_rerun;
+}
 
-  // TODO: Check the registers state with QEMU.
-  // Set `diff` as `true` if they are not the same.
-  // TODO();
-  if(r.eax!=cpu.eax){
-    diff=true;
-    printf("Diff : eax QEMU : 0x%08x\n",r.eax);
-    printf("           NEMU : 0x%08x\n",cpu.eax);
-  }
-  if(r.ecx!=cpu.ecx){
-    diff=true;
-    printf("Diff : ecx QEMU : 0x%08x\n",r.ecx);
-    printf("           NEMU : 0x%08x\n",cpu.ecx);
-  }
-  if(r.edx!=cpu.edx){
-    diff=true;
-    printf("Diff : edx QEMU : 0x%08x\n",r.edx);
-    printf("           NEMU : 0x%08x\n",cpu.edx);
-  }
-  if(r.ebx!=cpu.ebx){
-    diff=true;
-    printf("Diff : ebx QEMU : 0x%08x\n",r.ebx);
-    printf("           NEMU : 0x%08x\n",cpu.ebx);
-  }
-  if(r.esp!=cpu.esp){
-    diff=true;
-    printf("Diff : esp QEMU : 0x%08x\n",r.esp);
-    printf("           NEMU : 0x%08x\n",cpu.esp);
+/* The number of instructions cpu_exec() may run in the next step. */
+uint64_t difftest_budget(uint64_t n) {
+  return ((backend->single_step || single_step) && n > 1 ? 1 : n);
+}
+
+/* Send the pending step to the backend. */
+static void send_step(bool check) {
+  if (!is_failed) {
+    step.check = check;
+    step.check_mem = check && check_mem;
+    if (step.check_mem) step.mem_hash = pmem_written_hash();
+    backend->step(&step);
   }
-  if(r.ebp!=cpu.ebp){
-    diff=true;
-    printf("Diff : ebp QEMU : 0x%08x\n",r.ebp);
-    printf("           NEMU : 0x%08x\n",cpu.ebp);
+  unchecked = !check;
+  step.n = 0;
+  step.intr = -1;
+  step.skip_ref = step.skip_dut = false;
+}
+
+/* Wait for the check of the step just sent. Keep the state at a new
+ * checkpoint if it matches, otherwise re-run from the last one to find
+ * the first instruction which differs.
+ */
+static void check_point() {
+  backend->sync();
+  if (is_failed) {
+    checkpoint_bisect(nr_guest_instr);
   }
-  if(r.esi!=cpu.esi){
-    diff=true;
-    printf("Diff : esi QEMU : 0x%08x\n",r.esi);
-    printf("           NEMU : 0x%08x\n",cpu.esi);
+  else {
+    checkpoint_take();
+    next_ckpt = nr_guest_instr + ckpt_interval;
   }
-  if(r.edi!=cpu.edi){
-    diff=true;
-    printf("Diff : edi QEMU : 0x%08x\n",r.edi);
-    printf("           NEMU : 0x%08x\n",cpu.edi);
+}
+
+/* Called by cpu_exec() after NEMU executes n instructions. */
+void difftest_step(uint32_t n) {
+  step.n += n;
+  bool check = (ckpt_interval == 0 || nr_guest_instr >= next_ckpt);
+  /* the reference must take the interrupts and skips at the same places */
+  if (check || step.intr >= 0 || step.skip_ref || step.skip_dut) {
+    send_step(check);
+    if (check && ckpt_interval > 0) check_point();
   }
-  if(r.eip!=cpu.eip){
-    diff=true;
-    printf("Diff : eip QEMU : 0x%08x\n",r.eip);
-    printf("           NEMU : 0x%08x\n",cpu.eip);
+
+  if (is_failed) {
+    nemu_state = NEMU_END;
   }
+}
 
-  if (diff) {
+/* Called by cpu_exec() before returning to the monitor. */
+void difftest_sync() {
+  if (step.n > 0 || unchecked) {
+    send_step(true);
+    if (ckpt_interval > 0) check_point();
+  }
+  if (backend->sync != NULL) backend->sync();
+  if (is_failed) {
     nemu_state = NEMU_END;
   }
 }
@@ -0,0 +1,183 @@
+#include "nemu.h"
+#include "monitor/diff-test.h"
+#include "device/event.h"
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <signal.h>
+
+#include "protocol.h"
+#include <stdlib.h>
+
+bool gdb_connect_qemu(void);
+bool gdb_memcpy_to_qemu(uint32_t, void *, int);
+bool gdb_getregs(union gdb_regs *);
+bool gdb_setregs(union gdb_regs *);
+bool gdb_si(void);
+void gdb_exit(void);
+
+#define regcpy_from_nemu(regs) \
+  do { \
+    regs.eax = cpu.eax; \
+    regs.ecx = cpu.ecx; \
+    regs.edx = cpu.edx; \
+    regs.ebx = cpu.ebx; \
+    regs.esp = cpu.esp; \
+    regs.ebp = cpu.ebp; \
+    regs.esi = cpu.esi; \
+    regs.edi = cpu.edi; \
+    regs.eip = cpu.eip; \
+  } while (0)
+
+static uint8_t mbr[] = {
+  // start16:
+  0xfa,                           // cli
+  0x31, 0xc0,                     // xorw   %ax,%ax
+  0x8e, 0xd8,                     // movw   %ax,%ds
+  0x8e, 0xc0,                     // movw   %ax,%es
+  0x8e, 0xd0,                     // movw   %ax,%ss
+  0x0f, 0x01, 0x16, 0x44, 0x7c,   // lgdt   gdtdesc
+  0x0f, 0x20, 0xc0,               // movl   %cr0,%eax
+  0x66, 0x83, 0xc8, 0x01,         // orl    $CR0_PE,%eax
+  0x0f, 0x22, 0xc0,               // movl   %eax,%cr0
+  0xea, 0x1d, 0x7c, 0x08, 0x00,   // ljmp   $GDT_ENTRY(1),$start32
+
+  // start32:
+  0x66, 0xb8, 0x10, 0x00,         // movw   $0x10,%ax
+  0x8e, 0xd8,                     // movw   %ax, %ds
+  0x8e, 0xc0,                     // movw   %ax, %es
+  0x8e, 0xd0,                     // movw   %ax, %ss
+  0xeb, 0xfe,                     // jmp    7c27
+  0x8d, 0x76, 0x00,               // lea    0x0(%esi),%esi
+
+  // GDT
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0xff, 0xff, 0x00, 0x00, 0x00, 0x9a, 0xcf, 0x00,
+  0xff, 0xff, 0x00, 0x00, 0x00, 0x92, 0xcf, 0x00,
+
+  // GDT descriptor
+  0x17, 0x00, 0x2c, 0x7c, 0x00, 0x00
+};
+
+static void qemu_init(void) {
+  int ppid_before_fork = getpid();
+  int pid = fork();
+  if (pid == -1) {
+    perror("fork");
+    panic("fork error");
+  }
+  else if (pid == 0) {
+    // child
+
+    // install a parent death signal in the chlid
+    int r = prctl(PR_SET_PDEATHSIG, SIGTERM);
+    if (r == -1) {
+      perror("prctl error");
+      panic("prctl");
+    }
+
+    if (getppid() != ppid_before_fork) {
+      panic("parent has died!");
+    }
+
+    close(STDIN_FILENO);
+    execlp("qemu-system-i386", "qemu-system-i386", "-S", "-s", "-nographic", NULL);
+    perror("exec");
+    panic("exec error");
+  }
+  else {
+    // father
+
+    gdb_connect_qemu();
+    Log("Connect to QEMU successfully");
+
+    atexit(gdb_exit);
+
+    // put the MBR code to QEMU to enable protected mode
+    bool ok = gdb_memcpy_to_qemu(0x7c00, mbr, sizeof(mbr));
+    assert(ok == 1);
+
+    union gdb_regs r;
+    gdb_getregs(&r);
+
+    // set cs:eip to 0000:7c00
+    r.eip = 0x7c00;
+    r.cs = 0x0000;
+    ok = gdb_setregs(&r);
+    assert(ok == 1);
+
+    // execute enough instructions to enter protected mode
+    int i;
+    for (i = 0; i < 20; i ++) {
+      gdb_si();
+    }
+  }
+}
+
+static void qemu_memcpy(paddr_t addr, void *src, size_t n) {
+  bool ok = gdb_memcpy_to_qemu(addr, src, n);
+  assert(ok == 1);
+}
+
+static void qemu_setregs() {
+  union gdb_regs r;
+  gdb_getregs(&r);
+  regcpy_from_nemu(r);
+  bool ok = gdb_setregs(&r);
+  assert(ok == 1);
+}
+
+#define check_reg(r, reg) \
+  do { \
+    if (r.reg != cpu.reg) { \
+      diff = true; \
+      printf("Diff : %s QEMU : 0x%08x\n", str(reg), r.reg); \
+      printf("           NEMU : 0x%08x\n", cpu.reg); \
+    } \
+  } while (0)
+
+static void qemu_step(const DiffStep *s) {
+  union gdb_regs r;
+  bool diff = false;
+
+  /* QEMU single-steps `int' into the first instruction of the handler,
+   * so it catches up with NEMU in the next step */
+  if (s->skip_dut) return;
+
+  if (s->skip_ref) {
+    // to skip the checking of an instruction, just copy the reg state to qemu
+    qemu_setregs();
+    return;
+  }
+
+  int i;
+  for (i = 0; i < s->n; i ++) {
+    gdb_si();
+  }
+
+  /* QEMU does not take interrupts from the devices of NEMU */
+  if (s->intr >= 0) {
+    qemu_setregs();
+    return;
+  }
+
+  gdb_getregs(&r);
+  check_reg(r, eax); check_reg(r, ecx); check_reg(r, edx); check_reg(r, ebx);
+  check_reg(r, esp); check_reg(r, ebp); check_reg(r, esi); check_reg(r, edi);
+  check_reg(r, eip);
+
+  if (diff) {
+    difftest_fail(nr_guest_instr, s->n, cpu.eip);
+  }
+}
+
+/* QEMU runs in a child process, and is single-stepped over the GDB
+ * remote protocol. It has none of the devices of NEMU.
+ */
+DiffTestBackend difftest_qemu = {
+  .name = "qemu",
+  .init = qemu_init,
+  .memcpy = qemu_memcpy,
+  .setregs = qemu_setregs,
+  .step = qemu_step,
+  .single_step = true,
+};
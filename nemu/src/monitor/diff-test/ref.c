@@ -0,0 +1,279 @@
+#include "nemu.h"
+#include "cpu/rtl.h"
+#include "monitor/diff-test.h"
+#include "device/event.h"
+#include <inttypes.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/* The in-process reference runs the guest with the plain interpreter of
+ * NEMU, without the decode cache, blocks or JIT, in a thread of its own.
+ * The thread has its own CPU state and caches (see CPU_LOCAL) and its
+ * own copy of pmem. NEMU queues each step with its state afterwards and
+ * goes on, so the reference checks the steps in parallel, and NEMU stops
+ * a few steps after a divergence.
+ *
+ * The reference does not run devices. The values NEMU reads from devices
+ * are queued, and returned to the device reads of the reference in the
+ * same order. Device writes of the reference are dropped.
+ *
+ * In a process forked at a checkpoint, the reference is started over
+ * with a copy of pmem, since the thread is not forked.
+ */
+
+#define NR_REQ 4096      // must be a power of 2
+#define NR_INPUT 65536   // must be a power of 2
+
+/* each thread needs room for the CPU_LOCAL state besides its stack */
+#define REF_STACK_SIZE (64 * 1024 * 1024)
+
+enum { REQ_STEP, REQ_SETREGS };
+
+typedef struct {
+  int type;
+  DiffStep step;
+  uint64_t instr;   // the number of instructions executed by NEMU so far
+  CPU_state cpu;    // the state of NEMU after the step
+} Request;
+
+/* Single-producer single-consumer queues. The heads are only written by
+ * NEMU, and the tails by the reference. */
+static Request reqs[NR_REQ];
+static uint32_t req_head, req_tail;
+static uint32_t inputs[NR_INPUT];
+static uint32_t input_head, input_tail;
+
+static uint8_t *ref_pmem;
+static volatile bool is_failed = false;
+/* the request being run by the reference, and eip before it */
+static const Request *cur_req;
+static vaddr_t cur_eip;
+
+CPU_LOCAL bool difftest_is_ref = false;
+
+#define load_acquire(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define store_release(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+/* Spin for a while before sleeping, since the other side is usually
+ * busy. Sleep longer if it is idle, e.g. NEMU waits for a command.
+ */
+#define wait_until(cond) \
+  do { \
+    int spin = 0; \
+    while (!(cond)) { \
+      if (++ spin > 1000) usleep(spin < 10000 ? 20 : 1000); \
+    } \
+  } while (0)
+
+/* eflags bits checked: CF, ZF, SF, IF and OF */
+#define EFLAGS_MASK 0xac1
+
+static inline uint32_t eflags_val(const CPU_state *c) {
+  uint32_t val;
+  memcpy(&val, &c->eflags, sizeof(val));
+  return val & EFLAGS_MASK;
+}
+
+static void ref_fail() {
+  fflush(stdout);
+  is_failed = true;
+  difftest_fail(cur_req->instr, cur_req->step.n, cur_eip);
+}
+
+static void ref_check(const Request *r, vaddr_t eip) {
+  static const char *names[] = { "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi" };
+  const CPU_state *dut = &r->cpu;
+  bool diff = false;
+
+#define header() \
+  do { \
+    if (!diff) { \
+      printf("Diff after %" PRIu64 " instructions, in the %u instructions from eip = 0x%08x\n", \
+          r->instr, r->step.n, eip); \
+      diff = true; \
+    } \
+  } while (0)
+
+#define report(name, ref_val, dut_val) \
+  do { \
+    header(); \
+    printf("Diff : %-6s REF : 0x%08x\n", name, ref_val); \
+    printf("              NEMU : 0x%08x\n", dut_val); \
+  } while (0)
+
+#define check(name, ref_val, dut_val) \
+  do { \
+    if ((ref_val) != (dut_val)) report(name, ref_val, dut_val); \
+  } while (0)
+
+  int i;
+  for (i = 0; i < 8; i ++) {
+    check(names[i], cpu.gpr[i]._32, dut->gpr[i]._32);
+  }
+  check("eip", cpu.eip, dut->eip);
+  check("eflags", eflags_val(&cpu), eflags_val(dut));
+  check("cs", cpu.cs, dut->cs);
+  check("cr0", cpu.CR0, dut->CR0);
+  check("cr3", cpu.CR3, dut->CR3);
+  check("idtr", cpu.idtr.base, dut->idtr.base);
+
+  if (r->step.check_mem && pmem_written_hash() != r->step.mem_hash) {
+    header();
+    printf("Diff : the memory written since the last check\n");
+  }
+
+#undef check
+#undef report
+#undef header
+
+  if (diff) ref_fail();
+}
+
+static void ref_step(const Request *r) {
+  const DiffStep *s = &r->step;
+  cur_req = r;
+  cur_eip = cpu.eip;
+  int i;
+  for (i = 0; i < s->n - s->skip_ref; i ++) {
+    exec_ref();
+  }
+
+  if (s->skip_ref) {
+    cpu = r->cpu;
+  }
+  else if (s->intr >= 0) {
+    exec_ref_intr(s->intr);
+  }
+
+  if (s->check) {
+    rtl_cc_sync();
+    ref_check(r, cur_eip);
+  }
+}
+
+static void* ref_main(void *arg) {
+  difftest_is_ref = true;
+  pmem = ref_pmem;
+
+  while (true) {
+    uint32_t tail = req_tail;
+    wait_until(load_acquire(&req_head) != tail);
+
+    /* after a divergence, the requests are only drained */
+    const Request *r = &reqs[tail & (NR_REQ - 1)];
+    if (!is_failed) {
+      if (r->type == REQ_SETREGS) cpu = r->cpu;
+      else ref_step(r);
+    }
+    store_release(&req_tail, tail + 1);
+  }
+  return NULL;
+}
+
+static void ref_push(int type, const DiffStep *s) {
+  uint32_t head = req_head;
+  wait_until(head - load_acquire(&req_tail) < NR_REQ);
+
+  Request *r = &reqs[head & (NR_REQ - 1)];
+  r->type = type;
+  if (s != NULL) r->step = *s;
+  r->instr = nr_guest_instr;
+  rtl_cc_sync();
+  r->cpu = cpu;
+  store_release(&req_head, head + 1);
+}
+
+static void ref_init() {
+  ref_pmem = mmap(NULL, pmem_size, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  Assert(ref_pmem != MAP_FAILED, "Can not allocate the memory of the reference");
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, REF_STACK_SIZE);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  pthread_t thread;
+  int ret = pthread_create(&thread, &attr, ref_main, NULL);
+  Assert(ret == 0, "Can not create the thread of the reference");
+  pthread_attr_destroy(&attr);
+}
+
+static void ref_memcpy(paddr_t addr, void *src, size_t n) {
+  /* only called before the reference runs */
+  assert(addr + n <= pmem_size);
+  memcpy(ref_pmem + addr, src, n);
+}
+
+static void ref_setregs() {
+  ref_push(REQ_SETREGS, NULL);
+}
+
+static void ref_step_push(const DiffStep *s) {
+  ref_push(REQ_STEP, s);
+}
+
+static void ref_device_read(uint32_t data) {
+  if (is_failed) return;
+  uint32_t head = input_head;
+  while (head - load_acquire(&input_tail) == NR_INPUT) {
+    /* the reads of the current step are not consumed until it is queued */
+    Assert(load_acquire(&req_tail) != req_head, "Too many device reads in a step");
+    usleep(20);
+  }
+  inputs[head & (NR_INPUT - 1)] = data;
+  store_release(&input_head, head + 1);
+}
+
+static inline bool page_is_zero(const uint8_t *page) {
+  const uint64_t *p = (const uint64_t *)page;
+  int i;
+  for (i = 0; i < 4096 / sizeof(*p); i ++) {
+    if (p[i] != 0) return false;
+  }
+  return true;
+}
+
+static void ref_restart() {
+  munmap(ref_pmem, pmem_size);
+  req_head = req_tail = input_head = input_tail = 0;
+  is_failed = false;
+  ref_init();
+
+  /* the pages never touched stay unpopulated */
+  paddr_t addr;
+  for (addr = 0; addr < pmem_size; addr += 4096) {
+    uint8_t *page = guest_to_host(addr);
+    if (!page_is_zero(page)) memcpy(ref_pmem + addr, page, 4096);
+  }
+  ref_setregs();
+}
+
+static void ref_sync() {
+  wait_until(load_acquire(&req_tail) == req_head);
+}
+
+/* Called by the reference instead of reading a device. */
+uint32_t difftest_ref_device_read() {
+  uint32_t tail = input_tail;
+  if (tail == load_acquire(&input_head)) {
+    printf("Diff : the reference reads a device at eip = 0x%08x, which NEMU does not\n", cpu.eip);
+    ref_fail();
+    return 0;
+  }
+  uint32_t data = inputs[tail & (NR_INPUT - 1)];
+  store_release(&input_tail, tail + 1);
+  return data;
+}
+
+DiffTestBackend difftest_ref = {
+  .name = "ref",
+  .init = ref_init,
+  .memcpy = ref_memcpy,
+  .setregs = ref_setregs,
+  .step = ref_step_push,
+  .device_read = ref_device_read,
+  .sync = ref_sync,
+  .restart = ref_restart,
+  .single_step = false,
+};
@@ -1,21 +1,53 @@
 #include "nemu.h"
+#include "device/replay.h"
+#include "monitor/snapshot.h"
+#include "cpu/mp.h"
+#include "monitor/batch.h"
+#include "monitor/diff-test.h"
+#include "monitor/itrace.h"
+#include "monitor/profile.h"
+#include "monitor/symbol.h"
+#include "monitor/ftrace.h"
+#include "cpu/opstat.h"
+#include "cpu/branch-pred.h"
 #include <unistd.h>
+#include <stdlib.h>
 
 #define ENTRY_START 0x100000
 
-void init_difftest();
 void init_regex();
 void init_wp_pool();
 void init_device();
 
 void reg_test();
-void init_qemu_reg();
-bool gdb_memcpy_to_qemu(uint32_t, void *, int);
 
 FILE *log_fp = NULL;
 static char *log_file = NULL;
 static char *img_file = NULL;
 static int is_batch_mode = false;
+static char *replay_file = NULL;
+static int replay_mode_arg = REPLAY_OFF;
+static char *snapshot_file = NULL;
+static char *snapshot_save_file = NULL;
+static uint64_t snapshot_save_instr = 0;
+static uint32_t pmem_size_arg = PMEM_SIZE;
+static bool pmem_huge_arg = false;
+static int nr_cpu_arg = 1;
+static bool batch_test = false;
+static int nr_worker = 0;
+static uint64_t instr_limit = -1;
+static int time_limit = 0;
+static char **imgs = NULL;
+static int nr_img = 0;
+static char *difftest_backend = "ref";
+static char *itrace_file = NULL;
+static uint64_t profile_interval = 0;
+static char *profile_file = NULL;
+static char *ftrace_file = NULL;
+static char *cache_config = NULL;
+static char *elf_files[16];
+static int nr_elf = 0;
+static uint64_t difftest_interval = 0;
 
 static inline void init_log() {
 #ifdef DEBUG
@@ -67,15 +99,19 @@ static inline void load_img() {
     fseek(fp, 0, SEEK_END);
     size = ftell(fp);
 
-    fseek(fp, 0, SEEK_SET);
-    ret = fread(guest_to_host(ENTRY_START), size, 1, fp);
-    assert(ret == 1);
+    /* Map the image instead of reading it, so that only the pages
+     * touched are loaded. Fall back to reading if it can not be mapped. */
+    if (!pmem_map_file(ENTRY_START, fileno(fp), size)) {
+      fseek(fp, 0, SEEK_SET);
+      ret = fread(guest_to_host(ENTRY_START), size, 1, fp);
+      assert(ret == 1);
+    }
 
     fclose(fp);
   }
 
 #ifdef DIFF_TEST
-  gdb_memcpy_to_qemu(ENTRY_START, guest_to_host(ENTRY_START), size);
+  difftest_memcpy(ENTRY_START, guest_to_host(ENTRY_START), size);
 #endif
 }
 
@@ -94,24 +130,91 @@ static inline void restart() {
   cpu.CR0=0x60000011;
 
 #ifdef DIFF_TEST
-  init_qemu_reg();
+  difftest_setregs();
 #endif
 }
 
 static inline void parse_args(int argc, char *argv[]) {
   int o;
-  while ( (o = getopt(argc, argv, "-bl:")) != -1) {
+  char *end;
+  while ( (o = getopt(argc, argv, "-bl:i:r:p:s:S:m:Hc:tj:L:T:d:C:P:E:F:k:")) != -1) {
     switch (o) {
       case 'b': is_batch_mode = true; break;
       case 'l': log_file = optarg; break;
+      case 'i': itrace_file = optarg; break;
+      case 'r': replay_file = optarg; replay_mode_arg = REPLAY_RECORD; break;
+      case 'p': replay_file = optarg; replay_mode_arg = REPLAY_PLAY; break;
+      case 's': snapshot_file = optarg; break;
+      case 'm': {
+                  /* in MB, checked by init_pmem() */
+                  uint64_t mb = strtoull(optarg, NULL, 0);
+                  pmem_size_arg = (mb <= (PMEM_MAX_SIZE >> 20) ? mb << 20 : 0);
+                  break;
+                }
+      case 'H': pmem_huge_arg = true; break;
+      case 'c': nr_cpu_arg = atoi(optarg); break;
+      case 't': batch_test = true; break;
+      case 'j': nr_worker = atoi(optarg); break;
+      case 'L': instr_limit = strtoull(optarg, NULL, 0); break;
+      case 'T': time_limit = atoi(optarg); break;
+      case 'd': difftest_backend = optarg; break;
+      case 'C': difftest_interval = strtoull(optarg, NULL, 0); break;
+      case 'P':
+                /* -P N[:file] */
+                profile_interval = strtoull(optarg, &end, 0);
+                if (profile_interval == 0 || (*end != '\0' && (*end != ':' || end[1] == '\0'))) {
+                  panic("Usage: -P sample_interval[:folded_file]");
+                }
+                profile_file = (*end == ':' ? end + 1 : NULL);
+                break;
+      case 'F': ftrace_file = optarg; break;
+      case 'k': cache_config = optarg; break;
+      case 'E':
+                Assert(nr_elf < sizeof(elf_files) / sizeof(elf_files[0]), "Too many ELF files");
+                elf_files[nr_elf ++] = optarg;
+                break;
+      case 'S':
+                /* -S N:file */
+                snapshot_save_instr = strtoull(optarg, &end, 0);
+                if (snapshot_save_instr == 0 || *end != ':' || end[1] == '\0') {
+                  panic("Usage: -S instr_count:snapshot_file");
+                }
+                snapshot_save_file = end + 1;
+                break;
       case 1:
-                if (img_file != NULL) Log("too much argument '%s', ignored", optarg);
-                else img_file = optarg;
+                /* all images are kept for batch tests */
+                if (imgs == NULL) imgs = malloc(sizeof(char *) * argc);
+                imgs[nr_img ++] = optarg;
                 break;
       default:
-                panic("Usage: %s [-b] [-l log_file] [img_file]", argv[0]);
+                panic("Usage: %s [-b] [-l log_file] [-i itrace_file] [-r record_file | -p replay_file] "
+                    "[-s snapshot_file] [-S instr_count:snapshot_file] [-m pmem_MB] [-H] [-c nr_cpu] "
+                    "[-t [-j nr_worker] [-L instr_limit] [-T seconds] img_file...] [-d ref|qemu] [-C check_interval] [-P sample_interval[:folded_file]] [-F ftrace_file] [-k cache_config] [-E elf_file]... [img_file]", argv[0]);
     }
   }
+
+  if (batch_test) {
+#ifdef DIFF_TEST
+    panic("Batch tests are not supported in DIFF_TEST mode");
+#endif
+    Assert(nr_img > 0, "No image is given for batch tests");
+    Assert(replay_file == NULL && snapshot_file == NULL && snapshot_save_file == NULL,
+        "Batch tests can not record, replay or use snapshots");
+    return;
+  }
+  if (nr_img > 0) img_file = imgs[0];
+  int i;
+  for (i = 1; i < nr_img; i ++) {
+    Log("too much argument '%s', ignored", imgs[i]);
+  }
+}
+
+/* Put an image into a batch test worker. */
+static void batch_load(const char *img) {
+  img_file = (char *)img;
+  load_img();
+  restart();
+  init_mp(nr_cpu_arg);
 }
 
 int init_monitor(int argc, char *argv[]) {
@@ -126,16 +229,21 @@ int init_monitor(int argc, char *argv[]) {
   /* Test the implementation of the `CPU_state' structure. */
   reg_test();
 
+  /* Allocate the physical memory. */
+  init_pmem(pmem_size_arg, pmem_huge_arg);
+
 #ifdef DIFF_TEST
-  /* Fork a child process to perform differential testing. */
-  init_difftest();
+  /* Start the reference of differential testing. */
+  init_difftest(difftest_backend, difftest_interval);
 #endif
 
-  /* Load the image to memory. */
-  load_img();
+  if (!batch_test) {
+    /* Load the image to memory. */
+    load_img();
 
-  /* Initialize this virtual computer system. */
-  restart();
+    /* Initialize this virtual computer system. */
+    restart();
+  }
 
   /* Compile the regular expressions. */
   init_regex();
@@ -143,9 +251,86 @@ int init_monitor(int argc, char *argv[]) {
   /* Initialize the watchpoint pool. */
   init_wp_pool();
 
-  /* Initialize devices. */
+  /* Record or replay the inputs of devices. */
+  init_replay(replay_file, replay_mode_arg);
+
+  /* Register the state saved in snapshots. */
+  init_snapshot();
+
+  /* Initialize devices. The workers of batch tests have no window. */
+  if (batch_test) setenv("SDL_VIDEODRIVER", "dummy", 1);
   init_device();
 
+  /* Run the images of batch tests in workers forked from here, and exit. */
+  if (batch_test) {
+    batch_run(imgs, nr_img, nr_worker, instr_limit, time_limit, batch_load);
+  }
+
+  /* Create the other CPUs. Their interleaving is up to the host, so
+   * inputs can not be replayed. */
+  Assert(nr_cpu_arg == 1 || replay_mode_arg == REPLAY_OFF, "Record and replay need a single CPU");
+#ifdef DIFF_TEST
+  Assert(nr_cpu_arg == 1, "DIFF_TEST needs a single CPU");
+#endif
+  init_mp(nr_cpu_arg);
+
+  /* Restore the machine from a snapshot, or save one later. */
+  if (snapshot_file != NULL) {
+    bool ok = snapshot_load(snapshot_file);
+    Assert(ok, "Can not load snapshot '%s'", snapshot_file);
+  }
+  if (snapshot_save_file != NULL) {
+    snapshot_at(snapshot_save_instr, snapshot_save_file);
+  }
+
+  /* Load the symbols of the guest programs. */
+  int i;
+  for (i = 0; i < nr_elf; i ++) {
+    bool ok = symbol_load(elf_files[i]);
+    Assert(ok, "Can not load symbols from '%s'", elf_files[i]);
+  }
+
+  /* Sample the guest, and report at exit. */
+  if (profile_interval > 0) {
+    init_profile(profile_interval, profile_file);
+  }
+
+  /* Trace the calls of the guest, and report the call graph at exit. */
+  if (ftrace_file != NULL) {
+    init_ftrace(ftrace_file);
+  }
+
+#ifdef CACHE_SIM
+  /* Build the caches simulated, and report at exit. */
+  if (!init_cache(cache_config)) {
+    panic("Usage: -k l1i|l1d|l2=size[K|M]:assoc:line_size[:lru|fifo|random],...");
+  }
+#else
+  if (cache_config != NULL) {
+    Log("-k is ignored, the caches are only simulated with CACHE_SIM");
+  }
+#endif
+
+#ifdef BRANCH_SIM
+  /* Model the branch predictors, and report at exit. */
+  init_bpred();
+#endif
+
+#ifdef OPCODE_STAT
+  /* Report the opcodes executed at exit. */
+  init_opstat();
+#endif
+
+#ifdef ITRACE
+  /* Dump the instruction trace on a bad trap, a panic or a crash. */
+  init_itrace(itrace_file);
+#endif
+
+#ifdef DIFF_TEST
+  /* Keep the initial state as the first checkpoint. */
+  difftest_start();
+#endif
+
   /* Display welcome message. */
   welcome();
 
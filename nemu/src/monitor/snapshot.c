@@ -0,0 +1,334 @@
+#include "nemu.h"
+#include "monitor/monitor.h"
+#include "monitor/snapshot.h"
+#include "cpu/decode-cache.h"
+#include "device/event.h"
+#include "cpu/mp.h"
+#include <stdarg.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <libgen.h>
+#include <time.h>
+#include <unistd.h>
+
+/* A snapshot file is laid out as
+ *   magic, the id of the snapshot, the id of the parent,
+ *   the absolute path of the parent ("" for a full snapshot),
+ *   the number of pages, then (ppn, 4KB of data) for each page,
+ *   the number of sections, then (name, size, data) for each section.
+ * A full snapshot holds every non-zero page of pmem. Loading a snapshot
+ * loads the pages of its parents first, and the sections of itself only.
+ * A parent is also looked for next to its child, in case both are moved,
+ * and it must have the id recorded in the child, so a parent which is
+ * overwritten is rejected. Sections are matched by name, so a section
+ * which is missing in either the file or this NEMU is skipped.
+ */
+
+#define SNAPSHOT_MAGIC "NEMUSNP2"
+#define PATH_LEN PATH_MAX
+#define NAME_LEN 32
+#define NR_SECTION 128
+#define MAX_DEPTH 64
+#define PAGE_SIZE 4096
+
+typedef struct {
+  char name[NAME_LEN];
+  void *addr;
+  uint32_t size;
+} Section;
+
+static Section sections[NR_SECTION];
+static int nr_section = 0;
+
+/* the last snapshot saved or loaded, the parent of the next incremental
+ * one, by its absolute path and its id */
+static char last_snapshot[PATH_LEN];
+static uint64_t last_id;
+
+static int snapshot_event;
+static const char *snapshot_event_file;
+
+/* Register `size' bytes at `addr' as a section named by `fmt'. */
+void snapshot_add(void *addr, size_t size, const char *fmt, ...) {
+  assert(nr_section < NR_SECTION);
+  Section *s = &sections[nr_section ++];
+  va_list ap;
+  va_start(ap, fmt);
+  vsnprintf(s->name, NAME_LEN, fmt, ap);
+  va_end(ap);
+  s->addr = addr;
+  s->size = size;
+}
+
+void init_snapshot() {
+  snapshot_add(&cpu, sizeof(cpu), "cpu");
+  snapshot_add(&nr_guest_instr, sizeof(nr_guest_instr), "instr");
+}
+
+static inline bool page_is_zero(const uint8_t *page) {
+  const uint64_t *p = (const uint64_t *)page;
+  int i;
+  for (i = 0; i < PAGE_SIZE / sizeof(*p); i ++) {
+    if (p[i] != 0) return false;
+  }
+  return true;
+}
+
+/* A random id, so that different snapshots at the same path differ. */
+static uint64_t new_id() {
+  uint64_t id = 0;
+  FILE *fp = fopen("/dev/urandom", "rb");
+  if (fp != NULL) {
+    if (fread(&id, sizeof(id), 1, fp) != 1) id = 0;
+    fclose(fp);
+  }
+  id ^= ((uint64_t)time(NULL) << 32) ^ ((uint64_t)getpid() << 16) ^ (uintptr_t)&id;
+  return (id == 0 ? 1 : id);
+}
+
+bool snapshot_save(const char *file, bool incremental) {
+  if (nr_cpu > 1) {
+    printf("Snapshots support a single CPU only\n");
+    return false;
+  }
+  if (strlen(file) >= PATH_LEN) {
+    printf("The path '%s' is too long\n", file);
+    return false;
+  }
+  if (incremental && last_snapshot[0] == '\0') {
+    printf("No snapshot is saved or loaded yet, save a full one instead\n");
+    incremental = false;
+  }
+  char path[PATH_LEN];
+  if (incremental && realpath(file, path) != NULL && strcmp(path, last_snapshot) == 0) {
+    printf("Can not overwrite '%s', which is the parent of the snapshot\n", file);
+    return false;
+  }
+
+  FILE *fp = fopen(file, "wb");
+  if (fp == NULL) {
+    printf("Can not open '%s'\n", file);
+    return false;
+  }
+
+  static char parent[PATH_LEN];
+  memset(parent, 0, sizeof(parent));
+  uint64_t id = new_id(), parent_id = 0;
+  if (incremental) {
+    strcpy(parent, last_snapshot);
+    parent_id = last_id;
+  }
+  fwrite(SNAPSHOT_MAGIC, strlen(SNAPSHOT_MAGIC), 1, fp);
+  fwrite(&id, sizeof(id), 1, fp);
+  fwrite(&parent_id, sizeof(parent_id), 1, fp);
+  fwrite(parent, PATH_LEN, 1, fp);
+
+  /* the number of pages is filled in later */
+  uint32_t nr_page = 0, ppn;
+  long nr_page_pos = ftell(fp);
+  fwrite(&nr_page, sizeof(nr_page), 1, fp);
+  for (ppn = 0; ppn < (pmem_size >> 12); ppn ++) {
+    paddr_t addr = ppn << 12;
+    uint8_t *page = guest_to_host(addr);
+    if (incremental ? pmem_dirty[ppn] : !page_is_zero(page)) {
+      fwrite(&ppn, sizeof(ppn), 1, fp);
+      fwrite(page, PAGE_SIZE, 1, fp);
+      nr_page ++;
+    }
+  }
+
+  uint32_t n = nr_section;
+  int i;
+  fwrite(&n, sizeof(n), 1, fp);
+  for (i = 0; i < nr_section; i ++) {
+    fwrite(sections[i].name, NAME_LEN, 1, fp);
+    fwrite(&sections[i].size, sizeof(sections[i].size), 1, fp);
+    fwrite(sections[i].addr, sections[i].size, 1, fp);
+  }
+
+  fseek(fp, nr_page_pos, SEEK_SET);
+  fwrite(&nr_page, sizeof(nr_page), 1, fp);
+  bool ok = !ferror(fp);
+  ok = (fclose(fp) == 0) && ok;
+  if (!ok) {
+    printf("Failed to write '%s'\n", file);
+    return false;
+  }
+
+  if (realpath(file, last_snapshot) == NULL) {
+    last_snapshot[0] = '\0';
+  }
+  last_id = id;
+  pmem_clear_dirty();
+  Log("Saved %s snapshot %s with %u pages", incremental ? "an incremental" : "a full", file, nr_page);
+  return true;
+}
+
+/* Open the parent `path' of the snapshot `child', or the file of the
+ * same name next to the child. */
+static FILE* open_parent(const char *path, const char *child, char *found) {
+  FILE *fp = fopen(path, "rb");
+  if (fp != NULL) {
+    strcpy(found, path);
+    return fp;
+  }
+  char *child_copy = strdup(child), *parent_copy = strdup(path);
+  assert(child_copy != NULL && parent_copy != NULL);
+  int n = snprintf(found, PATH_LEN, "%s/%s", dirname(child_copy), basename(parent_copy));
+  free(child_copy);
+  free(parent_copy);
+  if (n >= PATH_LEN) return NULL;
+  return fopen(found, "rb");
+}
+
+/* Check the header of the snapshot opened as `fp', which must have the
+ * id `expected_id' unless it is 0, and load the pages of its parents, or
+ * clear pmem for a full snapshot. `parent' and `found' are buffers of
+ * PATH_LEN bytes.
+ */
+static FILE* load_pages(FILE *, const char *, uint64_t, uint64_t *, int);
+
+static bool load_header(FILE *fp, const char *file, uint64_t expected_id, uint64_t *id,
+    int depth, char *parent, char *found) {
+  char magic[sizeof(SNAPSHOT_MAGIC) - 1];
+  uint64_t parent_id;
+  if (fread(magic, sizeof(magic), 1, fp) != 1 || memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) != 0 ||
+      fread(id, sizeof(*id), 1, fp) != 1 || fread(&parent_id, sizeof(parent_id), 1, fp) != 1 ||
+      fread(parent, PATH_LEN, 1, fp) != 1) {
+    printf("'%s' is not a snapshot\n", file);
+    return false;
+  }
+  parent[PATH_LEN - 1] = '\0';
+  if (expected_id != 0 && *id != expected_id) {
+    printf("'%s' is not the snapshot which its child was saved from, it may be overwritten\n", file);
+    return false;
+  }
+
+  if (parent[0] == '\0') {
+    pmem_reset();
+    return true;
+  }
+  FILE *parent_fp = NULL;
+  if (depth < MAX_DEPTH) {
+    parent_fp = open_parent(parent, file, found);
+    if (parent_fp == NULL) {
+      printf("Can not open '%s'\n", parent);
+    }
+    else {
+      uint64_t unused;
+      parent_fp = load_pages(parent_fp, found, parent_id, &unused, depth + 1);
+    }
+  }
+  if (parent_fp == NULL) {
+    printf("Can not load the parent of '%s'\n", file);
+    return false;
+  }
+  fclose(parent_fp);
+  return true;
+}
+
+/* Load the pages of the snapshot opened as `fp' and its parents. Return
+ * the file positioned at the sections, and the id of the snapshot in
+ * `*id', or NULL if some file can not be opened, which closes `fp'. All
+ * files are opened before pmem is touched.
+ */
+static FILE* load_pages(FILE *fp, const char *file, uint64_t expected_id, uint64_t *id, int depth) {
+  /* one for each level of the recursion would be too large for the stack */
+  char *parent = malloc(PATH_LEN), *found = malloc(PATH_LEN);
+  assert(parent != NULL && found != NULL);
+  bool header_ok = load_header(fp, file, expected_id, id, depth, parent, found);
+  free(parent);
+  free(found);
+  if (!header_ok) {
+    fclose(fp);
+    return NULL;
+  }
+
+  uint32_t nr_page = 0, ppn, i;
+  bool ok = (fread(&nr_page, sizeof(nr_page), 1, fp) == 1);
+  for (i = 0; ok && i < nr_page; i ++) {
+    ok = (fread(&ppn, sizeof(ppn), 1, fp) == 1 && ppn < (pmem_size >> 12));
+    if (ok) {
+      paddr_t addr = ppn << 12;
+      ok = (fread(guest_to_host(addr), PAGE_SIZE, 1, fp) == 1);
+    }
+  }
+  /* pmem is partly overwritten, there is no way back */
+  Assert(ok, "'%s' is truncated, or larger than pmem", file);
+  return fp;
+}
+
+static void load_sections(FILE *fp, const char *file) {
+  uint32_t n = 0, size, i;
+  char name[NAME_LEN];
+  bool ok = (fread(&n, sizeof(n), 1, fp) == 1);
+  for (i = 0; ok && i < n; i ++) {
+    ok = (fread(name, NAME_LEN, 1, fp) == 1 && fread(&size, sizeof(size), 1, fp) == 1);
+    if (!ok) break;
+    name[NAME_LEN - 1] = '\0';
+
+    int j;
+    for (j = 0; j < nr_section; j ++) {
+      if (strcmp(sections[j].name, name) == 0) break;
+    }
+    if (j < nr_section && sections[j].size == size) {
+      ok = (fread(sections[j].addr, size, 1, fp) == 1);
+    }
+    else {
+      Log("Section '%s' in %s is skipped", name, file);
+      fseek(fp, size, SEEK_CUR);
+    }
+  }
+  Assert(ok, "'%s' is truncated", file);
+}
+
+bool snapshot_load(const char *file) {
+#ifdef DIFF_TEST
+  printf("Loading a snapshot is not supported in DIFF_TEST mode\n");
+  return false;
+#endif
+  if (nr_cpu > 1) {
+    printf("Snapshots support a single CPU only\n");
+    return false;
+  }
+  if (strlen(file) >= PATH_LEN) {
+    printf("The path '%s' is too long\n", file);
+    return false;
+  }
+
+  FILE *fp = fopen(file, "rb");
+  if (fp == NULL) {
+    printf("Can not open '%s'\n", file);
+    return false;
+  }
+  uint64_t id;
+  fp = load_pages(fp, file, 0, &id, 0);
+  if (fp == NULL) return false;
+  load_sections(fp, file);
+  fclose(fp);
+
+  /* forget everything derived from the old state */
+  tlb_flush();
+  decode_cache_flush();
+  update_next_event();
+
+  if (realpath(file, last_snapshot) == NULL) {
+    last_snapshot[0] = '\0';
+  }
+  last_id = id;
+  pmem_clear_dirty();
+  nemu_state = NEMU_STOP;
+  Log("Loaded snapshot %s", file);
+  return true;
+}
+
+static void snapshot_event_handler() {
+  snapshot_save(snapshot_event_file, false);
+}
+
+/* Save a full snapshot to `file' after n instructions. */
+void snapshot_at(uint64_t n, const char *file) {
+  snapshot_event_file = file;
+  snapshot_event = add_event("snapshot", snapshot_event_handler);
+  event_schedule(snapshot_event, n);
+}
@@ -0,0 +1,79 @@
+#!/usr/bin/env python3
+
+# Print a function trace logged by NEMU with -F, see include/monitor/ftrace.h.
+# The functions are symbolized with nm.
+
+import argparse, bisect, os, struct, subprocess, sys
+
+MAGIC = b'NEMUFTR1'
+RECORD = struct.Struct('<QIIB3xI')
+KINDS = ['call', 'ret', 'intr', 'iret']
+
+def load(path):
+  with open(path, 'rb') as f:
+    data = f.read()
+  if data[:8] != MAGIC:
+    raise Exception('{0} is not a function trace'.format(path))
+  (size,) = struct.unpack_from('<I', data, 8)
+  if size != RECORD.size:
+    raise Exception('unknown record size {0}'.format(size))
+  n = (len(data) - 12) // size
+  return [RECORD.unpack_from(data, 12 + i * size) for i in range(n)]
+
+def execute(commands):
+  p = subprocess.Popen(commands, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+  (out, err) = p.communicate()
+  if p.returncode != 0:
+    raise Exception('Execute {0} fail: {1}'.format(' '.join(commands), err.decode()))
+  return out.decode()
+
+def load_symbols(elfs, nm_cmd):
+  syms = []
+  for elf in elfs:
+    for line in execute([nm_cmd, elf]).splitlines():
+      fields = line.split()
+      if len(fields) == 3 and fields[1] in 'tTwW':
+        syms.append((int(fields[0], 16), fields[2]))
+  syms.sort()
+  return syms
+
+def symbolize(syms, addr):
+  i = bisect.bisect_right(syms, (addr, '\xff')) - 1
+  if i >= 0 and syms[i][0] == addr:
+    return syms[i][1]
+  if i >= 0:
+    return '{0}+{1:#x}'.format(syms[i][1], addr - syms[i][0])
+  return '{0:#x}'.format(addr)
+
+def main():
+  parser = argparse.ArgumentParser(description='Print a function trace of NEMU.')
+  parser.add_argument('trace', help='the file logged by NEMU')
+  parser.add_argument('-E', '--elf', action='append', default=[], help='the ELF files of the guest')
+  parser.add_argument('-n', type=int, help='only the last N events')
+  parser.add_argument('-d', '--depth', type=int, help='only the events up to this depth')
+  parser.add_argument('--nm', default=os.environ.get('NM', 'nm'), help='the nm to use')
+  args = parser.parse_args()
+
+  records = load(args.trace)
+  if args.n is not None:
+    records = records[-args.n:] if args.n > 0 else []
+  syms = load_symbols(args.elf, args.nm)
+  for (instr, pc, target, kind, depth) in records:
+    is_call = kind in (0, 2)
+    # the depth of a call is counted after it
+    level = depth - 1 if is_call else depth
+    if args.depth is not None and level >= args.depth:
+      continue
+    if is_call:
+      text = '{0} {1}'.format(KINDS[kind], symbolize(syms, target))
+    elif target != 0:
+      text = '{0} from {1} to {2}'.format(KINDS[kind], symbolize(syms, target), symbolize(syms, pc))
+    else:
+      text = '{0} to {1} (unmatched)'.format(KINDS[kind], symbolize(syms, pc))
+    print('{0:>12} {1}{2}'.format(instr, '  ' * max(level, 0), text))
+
+if __name__ == '__main__':
+  try:
+    main()
+  except Exception as e:
+    sys.exit(str(e))
@@ -0,0 +1,124 @@
+#!/usr/bin/env python3
+
+# Disassemble and filter an instruction trace dumped by NEMU, see
+# include/monitor/itrace.h. The instructions are disassembled with objdump.
+
+import argparse, os, re, struct, subprocess, sys, tempfile
+
+MAGIC = b'NEMUITR1'
+RECORD = struct.Struct('<QIBB15s3x8I')
+REGS = ['eax', 'ecx', 'edx', 'ebx', 'esp', 'ebp', 'esi', 'edi']
+
+# instructions further apart are disassembled separately
+MAX_GAP = 4096
+
+def load(path):
+  with open(path, 'rb') as f:
+    data = f.read()
+  if data[:8] != MAGIC:
+    raise Exception('{0} is not an instruction trace'.format(path))
+  (size, n) = struct.unpack_from('<II', data, 8)
+  if size != RECORD.size:
+    raise Exception('unknown record size {0}'.format(size))
+  records = []
+  for i in range(n):
+    (seq, eip, length, changed, raw, *gpr) = RECORD.unpack_from(data, 16 + i * size)
+    records.append((seq, eip, raw[:length], changed, gpr))
+  return records
+
+def execute(commands):
+  p = subprocess.Popen(commands, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+  (out, err) = p.communicate()
+  if p.returncode != 0:
+    raise Exception('Execute {0} fail: {1}'.format(' '.join(commands), err.decode()))
+  return out.decode()
+
+def objdump(objdump_cmd, base, blob):
+  with tempfile.NamedTemporaryFile(suffix='.bin') as f:
+    f.write(blob)
+    f.flush()
+    out = execute([objdump_cmd, '-D', '-b', 'binary', '-mi386',
+      '--adjust-vma={0:#x}'.format(base), f.name])
+  asm = {}
+  for line in out.splitlines():
+    m = re.match(r'^\s*([0-9a-f]+):\t[0-9a-f ]+\t(.*)$', line)
+    if m:
+      asm[int(m.group(1), 16)] = m.group(2).strip()
+  return asm
+
+def disassemble(instrs, objdump_cmd):
+  """Disassemble the distinct (eip, bytes). The instructions are laid out
+  at their eip with nops in between. The code at an eip may have changed,
+  then each version goes to another layout."""
+  result = {}
+  pending = sorted(instrs)
+  while pending:
+    layout, rest, end = [], [], 0
+    for (eip, raw) in pending:
+      if layout and eip < end:
+        rest.append((eip, raw))
+      else:
+        layout.append((eip, raw))
+        end = eip + len(raw)
+    pending = rest
+
+    i = 0
+    while i < len(layout):
+      j = i + 1
+      while j < len(layout) and layout[j][0] - (layout[j - 1][0] + len(layout[j - 1][1])) <= MAX_GAP:
+        j += 1
+      base = layout[i][0]
+      blob = bytearray(b'\x90' * (layout[j - 1][0] + len(layout[j - 1][1]) - base))
+      for (eip, raw) in layout[i:j]:
+        blob[eip - base : eip - base + len(raw)] = raw
+      asm = objdump(objdump_cmd, base, bytes(blob))
+      for (eip, raw) in layout[i:j]:
+        # the trap of NEMU is not an i386 instruction
+        result[(eip, raw)] = 'nemu_trap' if raw == b'\xd6' else asm.get(eip, '(bad)')
+      i = j
+  return result
+
+def parse_range(s):
+  (lo, sep, hi) = s.partition('-')
+  lo = int(lo, 0) if lo else 0
+  hi = int(hi, 0) if hi else (1 << 64) - 1
+  return (lo, hi if sep else lo)
+
+def main():
+  parser = argparse.ArgumentParser(description='Disassemble an instruction trace of NEMU.')
+  parser.add_argument('trace', help='the file dumped by NEMU')
+  parser.add_argument('-n', type=int, help='only the last N instructions')
+  parser.add_argument('-e', '--eip', action='append', default=[], metavar='LO-HI',
+      help='only the instructions at eip in the range, e.g. 0x100000-0x100fff')
+  parser.add_argument('-s', '--seq', metavar='LO-HI', help='only the instructions numbered in the range')
+  parser.add_argument('-g', '--grep', metavar='REGEX', help='only the instructions whose assembly matches')
+  parser.add_argument('-r', '--regs', action='store_true', help='show the registers changed by each instruction')
+  parser.add_argument('--objdump', default=os.environ.get('OBJDUMP', 'objdump'), help='the objdump to use')
+  args = parser.parse_args()
+
+  records = load(args.trace)
+  if args.seq:
+    (lo, hi) = parse_range(args.seq)
+    records = [r for r in records if lo <= r[0] <= hi]
+  if args.eip:
+    ranges = [parse_range(e) for e in args.eip]
+    records = [r for r in records if any(lo <= r[1] <= hi for (lo, hi) in ranges)]
+  if args.n is not None:
+    records = records[-args.n:] if args.n > 0 else []
+
+  asm = disassemble(set((r[1], r[2]) for r in records), args.objdump)
+  pattern = re.compile(args.grep) if args.grep else None
+  for (seq, eip, raw, changed, gpr) in records:
+    text = asm[(eip, raw)]
+    if pattern and not pattern.search(text):
+      continue
+    line = '{0:>10} {1:8x}:   {2:<30} {3}'.format(seq, eip, ' '.join('%02x' % b for b in raw), text)
+    if args.regs and changed:
+      line += '   ; ' + ' '.join('{0}={1:#x}'.format(REGS[i], gpr[i]) for i in range(8) if changed & (1 << i))
+    print(line)
+
+if __name__ == '__main__':
+  try:
+    main()
+  except Exception as e:
+    sys.exit(str(e))
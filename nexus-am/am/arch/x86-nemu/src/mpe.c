@@ -0,0 +1,64 @@
+#include <am.h>
+#include <x86.h>
+
+#define MPE_PORT 0x4c   // Note that this is not standard
+#define NR_CPU_PORT (MPE_PORT + 0)
+#define CPU_ID_PORT (MPE_PORT + 4)
+#define START_PORT  (MPE_PORT + 8)
+#define HALT_PORT   (MPE_PORT + 12)
+
+#define STACK_SHIFT 14   // 16KB for each CPU
+
+int _NR_CPU = 1;
+
+static void (*mpe_entry)();
+__attribute__((used, aligned(16)))
+static uint8_t mpe_stack[MAX_CPU][1 << STACK_SHIFT];
+
+void _mpe_ap_start();
+
+// Other CPUs start here with the registers of CPU 0, so the stack of
+// this CPU is set up before anything is pushed.
+#define str_(x) #x
+#define str(x) str_(x)
+asm(
+  ".globl _mpe_ap_start\n"
+  "_mpe_ap_start:\n"
+  "  movl $" str(CPU_ID_PORT) ", %edx\n"
+  "  inl %dx, %eax\n"
+  "  incl %eax\n"
+  "  shll $" str(STACK_SHIFT) ", %eax\n"
+  "  leal mpe_stack(%eax), %esp\n"
+  "  movl $0, %ebp\n"
+  "  call _mpe_ap_main\n"
+);
+
+__attribute__((used))
+static void _mpe_ap_main() {
+  mpe_entry();
+  outl(HALT_PORT, 0);
+  while (1);
+}
+
+void _mpe_init(void (*entry)()) {
+  mpe_entry = entry;
+  _NR_CPU = inl(NR_CPU_PORT);
+  outl(START_PORT, (uint32_t)_mpe_ap_start);
+  entry();
+  _halt(0);
+}
+
+int _cpu() {
+  return inl(CPU_ID_PORT);
+}
+
+intptr_t _atomic_xchg(volatile intptr_t *addr, intptr_t newval) {
+  // xchg with a memory operand is always locked
+  intptr_t result;
+  asm volatile ("xchgl %0, %1" : "+m"(*addr), "=a"(result) : "1"(newval) : "cc");
+  return result;
+}
+
+void _barrier() {
+  asm volatile ("lock; addl $0, (%%esp)" : : : "memory");
+}
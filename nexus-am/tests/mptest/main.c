@@ -0,0 +1,55 @@
+#include <am.h>
+#include <klib.h>
+
+// Run with several CPUs, e.g.
+//   make -C $NEMU_HOME run ARGS="-c 4 $AM_HOME/tests/mptest/build/mptest-x86-nemu.bin"
+// It ends with _halt(0) if all counters are right.
+
+#define N 100000
+
+static volatile intptr_t lk = 0;
+static volatile int locked_counter = 0;   // incremented under the spinlock
+static volatile int atomic_counter = 0;   // incremented by lock incl
+// incremented by lock incl, while it is also taken with xchg and added back
+static volatile intptr_t mixed_counter = 0;
+static volatile int nr_done = 0;
+
+static void lock() {
+  while (_atomic_xchg(&lk, 1));
+}
+
+static void unlock() {
+  _atomic_xchg(&lk, 0);
+}
+
+static void worker() {
+  int i;
+  for (i = 0; i < N; i ++) {
+    lock();
+    locked_counter ++;
+    unlock();
+    asm volatile ("lock; incl %0" : "+m"(atomic_counter));
+
+    asm volatile ("lock; incl %0" : "+m"(mixed_counter));
+    intptr_t taken = _atomic_xchg(&mixed_counter, 0);
+    asm volatile ("lock; addl %1, %0" : "+m"(mixed_counter) : "r"(taken));
+  }
+
+  lock();
+  nr_done ++;
+  unlock();
+
+  if (_cpu() != 0) return;
+
+  while (nr_done < _NR_CPU) _barrier();
+  printf("%d CPUs: locked_counter = %d, atomic_counter = %d, mixed_counter = %d\n",
+      _NR_CPU, locked_counter, atomic_counter, mixed_counter);
+  assert(locked_counter == N * _NR_CPU);
+  assert(atomic_counter == N * _NR_CPU);
+  assert(mixed_counter == N * _NR_CPU);
+}
+
+int main() {
+  _mpe_init(worker);
+  return 1;
+}